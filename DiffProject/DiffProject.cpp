@@ -4,514 +4,1904 @@
 #include <algorithm>
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <array>
 #include <string>
 #include <iomanip>
+#include <climits>
+#include <limits>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <functional>
 
 #include "dashDiff.h"
+#include "dashExtend.h"
+#include "dashPatch.h"
 
 namespace dashDiff
 {
 
 
-		// Handles obtaining free threads and locking them until the request is fulfilled and deleted.
-	threadRequest *dashDiff::threadDistributer(void)
+	workPool& dashDiff::workers(void)
 	{
-		threadRequest* response = new threadRequest();
-
-		for (int i = 0; i < THREADCOUNT; i++)
+		if (!pool)
 		{
-			if (!threadActive[i])
+			taskStatuses = std::make_unique<taskStatus[]>(threadCount);
+			for (size_t i = 0; i < threadCount; i++)
 			{
-				threadActive[i] = true;
-				response->threadId = i;
-				break;
+				taskStatuses[i].oldSeedsDone = taskStatuses[i].oldSeedsTotal = taskStatuses[i].seedPairs = 0;
+				taskStatuses[i].splitRequests = 0;
 			}
-		}
 
-		if (response->threadId == -1)
-		{
-			delete response;
-			return nullptr;
+			pool = std::make_unique<workPool>(threadCount, [this]() { requestSplit(); });
+
+			workerRuns.clear();
+			workerRuns.resize(threadCount + 1);
 		}
-		return response;
+
+		return *pool;
 	}
 
-	bool dashDiff::threadsActive(void)
+	void dashDiff::requestSplit(void)
 	{
-		for (int i = 0; i < THREADCOUNT; i++)
+		// Ask whichever running task has the most old seeds left, counting the splits it already owes, to give half back.
+		size_t mostLeft = 1;
+		int victim = -1;
+
+		for (size_t i = 0; i < threadCount; i++)
 		{
-			if (threadActive[i])
-				return true;
+			size_t total = taskStatuses[i].oldSeedsTotal, done = taskStatuses[i].oldSeedsDone;
+			size_t left = total > done ? (total - done) / (taskStatuses[i].splitRequests + 1) : 0;
+
+			if (left > mostLeft)
+			{
+				mostLeft = left;
+				victim = (int)i;
+			}
 		}
-		return false;
+
+		if (victim >= 0)
+			taskStatuses[victim].splitRequests++;
 	}
 
-	bool dashDiff::valuesOverlap(characterRange& a, characterRange& b)
+	void dashDiff::mergeRuns(void)
 	{
-		// if the space required to fit both ranges is less than the sum of the two ranges, they overlap.
-		if ((int)std::max(a.end, b.end) - (int)std::min(a.start, b.start) < (a.end - a.start) + (b.end - b.start))
+		// Each run is already sorted by old offset, so a k-way merge through a heap of run heads gets the whole set
+		// sorted in one linear pass, and chainRanges finds nothing left to sort.
+		auto later = [](const std::pair<dualRange*, dualRange*>& a, const std::pair<dualRange*, dualRange*>& b)
+		{
+			return a.first->oldRange.start > b.first->oldRange.start ||
+				(a.first->oldRange.start == b.first->oldRange.start && a.first->newRange.start > b.first->newRange.start);
+		};
+		std::vector<std::pair<dualRange*, dualRange*>> heads; // Next range and end of every run.
+		size_t total = 0;
+
+		for (auto& runs : workerRuns)
+		{
+			for (auto& run : runs)
+			{
+				heads.push_back({ run.data(), run.data() + run.size() });
+				total += run.size();
+			}
+		}
+
+		rangeVector.reserve(total);
+		std::make_heap(heads.begin(), heads.end(), later);
+		while (!heads.empty())
 		{
-			return true;
+			std::pop_heap(heads.begin(), heads.end(), later);
+			rangeVector.push_back(*heads.back().first++);
+
+			if (heads.back().first == heads.back().second)
+				heads.pop_back();
+			else
+				std::push_heap(heads.begin(), heads.end(), later);
 		}
-		return false;
+
+		for (auto& runs : workerRuns)
+			runs.clear();
 	}
 
-	void dashDiff::removeWeakOverlaps(void)
+	void dashDiff::chainRanges(void)
 	{
 		// All the ranges need to be in the same order per side, as all we can do now to differentiate the files is delete from the old
-		// or insert into the new. The number of bytes is immaterial, but out of order ranges are fools dreams. The decision is easy, however.
-		// The bigger range wins.
+		// or insert into the new. Out of order ranges are fools dreams, so keep the heaviest chain of ranges that climbs on both sides:
+		// a weighted longest increasing subsequence of new file offsets, taken in old file order.
+		auto oldThenNew = [](const dualRange& a, const dualRange& b)
+		{
+			return a.oldRange.start < b.oldRange.start || (a.oldRange.start == b.oldRange.start && a.newRange.start < b.newRange.start);
+		};
 
-		for (int i = 0; i < rangeVector.size(); i++)
+		if (rangeVector.size() < 2)
+			return;
+
+		if (!std::is_sorted(rangeVector.begin(), rangeVector.end(), oldThenNew))
+			std::sort(rangeVector.begin(), rangeVector.end(), oldThenNew);
+
+		std::vector<const char*> newStarts(rangeVector.size());
+		for (size_t i = 0; i < rangeVector.size(); i++)
+			newStarts[i] = rangeVector[i].newRange.start;
+		std::sort(newStarts.begin(), newStarts.end());
+		newStarts.erase(std::unique(newStarts.begin(), newStarts.end()), newStarts.end());
+
+		// Fenwick tree over new file offsets holding the best chain (weight, last range) ending below each offset.
+		std::vector<std::pair<size_t, ptrdiff_t>> fenwick(newStarts.size() + 1, { 0, -1 });
+		std::vector<size_t> chainWeight(rangeVector.size());
+		std::vector<ptrdiff_t> chainParent(rangeVector.size());
+
+		for (size_t groupStart = 0; groupStart < rangeVector.size();)
 		{
-			for (int j = i; j < rangeVector.size(); j++)
+			size_t groupEnd = groupStart;
+
+			// Ranges sharing an old offset can't follow each other, so query the whole group before any of it goes in the tree.
+			while (groupEnd < rangeVector.size() && rangeVector[groupEnd].oldRange.start == rangeVector[groupStart].oldRange.start)
 			{
-				if (i == j)
-					continue;
+				size_t rank = std::lower_bound(newStarts.begin(), newStarts.end(), rangeVector[groupEnd].newRange.start) - newStarts.begin();
+				std::pair<size_t, ptrdiff_t> best = { 0, -1 };
 
-				if ((rangeVector[i].oldRange.start > rangeVector[j].oldRange.start &&
-					rangeVector[i].newRange.start < rangeVector[j].newRange.start) ||
-					(rangeVector[i].oldRange.start < rangeVector[j].oldRange.start &&
-						rangeVector[i].newRange.start > rangeVector[j].newRange.start))
+				for (size_t node = rank; node > 0; node -= node & (0 - node))
 				{
-					// Delete the smaller of the two as they are out of order.
-					if (rangeVector[i].rangeSize >= rangeVector[j].rangeSize)
-					{
-						rangeVector.erase(rangeVector.begin() + j);
-						j--;
-					}
-					else
-					{
-						rangeVector.erase(rangeVector.begin() + i);
-						i--;
-						break;
-					}
+					if (fenwick[node].first > best.first)
+						best = fenwick[node];
+				}
+
+				chainWeight[groupEnd] = best.first + rangeVector[groupEnd].rangeSize;
+				chainParent[groupEnd] = best.second;
+				groupEnd++;
+			}
+
+			for (size_t i = groupStart; i < groupEnd; i++)
+			{
+				size_t rank = std::lower_bound(newStarts.begin(), newStarts.end(), rangeVector[i].newRange.start) - newStarts.begin();
+
+				for (size_t node = rank + 1; node < fenwick.size(); node += node & (0 - node))
+				{
+					if (chainWeight[i] > fenwick[node].first)
+						fenwick[node] = { chainWeight[i], (ptrdiff_t)i };
 				}
 			}
+
+			groupStart = groupEnd;
 		}
-	}
 
-	void dashDiff::removeOverlapEntry(int* it)
-	{
-		rangeVector.erase(rangeVector.begin() + *it);
+		// Walk the heaviest chain back from its last range.
+		std::vector<dualRange> chain;
+		ptrdiff_t link = std::max_element(chainWeight.begin(), chainWeight.end()) - chainWeight.begin();
+
+		for (; link != -1; link = chainParent[link])
+			chain.push_back(rangeVector[link]);
 
-		*it--;
+		std::reverse(chain.begin(), chain.end());
+		rangeVector.swap(chain);
 	}
 
 	void dashDiff::reduceOverlaps(void)
 	{
-		if (rangeVector.size() > 1)
+		// Pick the set of ranges that keeps the most bytes the same, with nothing overlapping on either side. It's weighted interval
+		// scheduling: best[i] is the most bytes any valid set ending in range i can keep. Rather than throw a range away because it
+		// clips its neighbour, it can also have its front trimmed off so it starts where the neighbour ends, keeping the rest.
+		if (rangeVector.size() < 2)
+			return;
+
+		const size_t count = rangeVector.size();
+
+		std::sort(rangeVector.begin(), rangeVector.end(), [](const dualRange& a, const dualRange& b)
 		{
-			for (int xt = 0; xt < rangeVector.size(); xt++)
+			return a.oldRange.start < b.oldRange.start || (a.oldRange.start == b.oldRange.start && a.newRange.start < b.newRange.start);
+		});
+
+		// Ranges in order of where they end in the old file, they become possible predecessors once we're past that point.
+		std::vector<size_t> byOldEnd(count);
+		for (size_t i = 0; i < count; i++)
+			byOldEnd[i] = i;
+		std::sort(byOldEnd.begin(), byOldEnd.end(), [&](size_t a, size_t b) { return rangeVector[a].oldRange.end < rangeVector[b].oldRange.end; });
+
+		std::vector<const char*> newEnds(count);
+		for (size_t i = 0; i < count; i++)
+			newEnds[i] = rangeVector[i].newRange.end;
+		std::sort(newEnds.begin(), newEnds.end());
+		newEnds.erase(std::unique(newEnds.begin(), newEnds.end()), newEnds.end());
+
+		// Fenwick tree over new file end offsets, the best set (bytes, last range) among predecessors ending at or before each offset.
+		std::vector<std::pair<size_t, ptrdiff_t>> fenwick(newEnds.size() + 1, { 0, -1 });
+		std::vector<size_t> best(count), trim(count);
+		std::vector<ptrdiff_t> parent(count);
+		size_t nextPredecessor = 0;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			dualRange& range = rangeVector[i];
+
+			// Everything that ends in the old file before this range starts goes in the tree.
+			for (; nextPredecessor < count && rangeVector[byOldEnd[nextPredecessor]].oldRange.end <= range.oldRange.start; nextPredecessor++)
 			{
-				for (int it = xt; it < rangeVector.size(); it++)
+				size_t j = byOldEnd[nextPredecessor];
+				size_t rank = std::lower_bound(newEnds.begin(), newEnds.end(), rangeVector[j].newRange.end) - newEnds.begin();
+
+				for (size_t node = rank + 1; node < fenwick.size(); node += node & (0 - node))
 				{
-					if (xt == it)
-						continue;
+					if (best[j] > fenwick[node].first)
+						fenwick[node] = { best[j], (ptrdiff_t)j };
+				}
+			}
 
-					if (valuesOverlap(rangeVector[xt].oldRange, rangeVector[it].oldRange))
-					{
-						// If this range is bigger than the one we're comparing it to, remove the smaller one.
+			// Best predecessor that's clear of this range on both sides.
+			size_t clearRank = std::upper_bound(newEnds.begin(), newEnds.end(), range.newRange.start) - newEnds.begin();
+			std::pair<size_t, ptrdiff_t> clear = { 0, -1 };
+
+			for (size_t node = clearRank; node > 0; node -= node & (0 - node))
+			{
+				if (fenwick[node].first > clear.first)
+					clear = fenwick[node];
+			}
+
+			best[i] = clear.first + range.rangeSize;
+			parent[i] = clear.second;
+			trim[i] = 0;
+
+			// The ranges just before this one are the ones it's most likely to clip. Try trimming it to follow each of them.
+			for (size_t j = i > OVERLAPTRIMWINDOW ? i - OVERLAPTRIMWINDOW : 0; j < i; j++)
+			{
+				ptrdiff_t cut = std::max(rangeVector[j].oldRange.end - range.oldRange.start, rangeVector[j].newRange.end - range.newRange.start);
+
+				if (cut <= 0 || range.rangeSize < (size_t)cut + minimumMatch)
+					continue; // Either it's clear already and the tree covered it, or there's not enough left to be worth a S[n].
+
+				if (best[j] + range.rangeSize - cut > best[i])
+				{
+					best[i] = best[j] + range.rangeSize - cut;
+					parent[i] = (ptrdiff_t)j;
+					trim[i] = cut;
+				}
+			}
+		}
+
+		// Walk the best set back from its last range, applying the trims on the way.
+		std::vector<dualRange> kept;
+		ptrdiff_t link = std::max_element(best.begin(), best.end()) - best.begin();
+
+		for (; link != -1; link = parent[link])
+		{
+			dualRange range = rangeVector[link];
+
+			range.oldRange.start += trim[link];
+			range.newRange.start += trim[link];
+			range.rangeSize -= trim[link];
+			kept.push_back(range);
+		}
+
+		std::reverse(kept.begin(), kept.end());
+		rangeVector.swap(kept);
+	}
+
+	differencesReport dashDiff::getReport(void)
+	{
+		return report;
+	}
+
+	void dashDiff::planSeedTiles(std::vector<seedTile>& tiles)
+	{
+		// Both sides of a bucket are sorted by k-gram, so walking them together finds every group of old seeds and the run of
+		// new seeds sharing their k-gram. Only those pairs get extended, a group costs old count times new count, plus one per
+		// old seed for its binary search. Skewed text piles most of that into a few groups in a few buckets (spaces, "e",
+		// newlines), so a bucket's size says little about its cost.
+		auto walkGroups = [this](int bucket, auto&& visit)
+		{
+			seedOffset* oldBucket = oldSeeds.bucketBegin(bucket);
+			seedOffset* newBucket = newSeeds.bucketBegin(bucket);
+			size_t oldSize = oldSeeds.bucketSize(bucket), newSize = newSeeds.bucketSize(bucket);
+
+			for (size_t j = 0, x = 0; j < oldSize;)
+			{
+				uint64_t key = gramKey(&oldFileBuffer[oldBucket[j]], minimumMatch);
+				size_t jEnd = j + 1, xEnd;
+
+				while (jEnd < oldSize && gramKey(&oldFileBuffer[oldBucket[jEnd]], minimumMatch) == key)
+					jEnd++;
+				while (x < newSize && gramKey(&newFileBuffer[newBucket[x]], minimumMatch) < key)
+					x++;
+				for (xEnd = x; xEnd < newSize && gramKey(&newFileBuffer[newBucket[xEnd]], minimumMatch) == key; xEnd++)
+					;
+
+				visit(j, jEnd, x, xEnd, (jEnd - j) * (xEnd - x) + (jEnd - j));
+				j = jEnd;
+				x = xEnd;
+			}
+		};
+
+		// First pass prices every bucket so we know how big a tile should be.
+		std::atomic<size_t> totalCost(0);
+
+		for (int i = 0; i < 256; i++)
+		{
+			if (oldSeeds.bucketSize(i) == 0 || newSeeds.bucketSize(i) == 0)
+				continue; // Skip this bucket if it doesn't exist in both files, it can't be valid.
+
+			workers().submit([&, i]()
+			{
+				size_t bucketCost = 0;
+
+				walkGroups(i, [&](size_t, size_t, size_t, size_t, size_t cost) { bucketCost += cost; });
+				totalCost += bucketCost;
+			});
+		}
+		workers().wait();
+
+		const size_t tileCost = std::max<size_t>(SEEDTILEMINIMUM, totalCost / (threadCount * SEEDTILESPERWORKER));
+		std::vector<std::vector<seedTile>> bucketTiles(256);
+
+		// Second pass cuts them up. Runs of cheap groups are packed into tiles of consecutive old seeds against the whole new
+		// bucket, a group that's too expensive on its own is cut into a grid of old by new tiles.
+		for (int i = 0; i < 256; i++)
+		{
+			if (oldSeeds.bucketSize(i) == 0 || newSeeds.bucketSize(i) == 0)
+				continue;
+
+			workers().submit([&, i]()
+			{
+				std::vector<seedTile>& out = bucketTiles[i];
+				const size_t newSize = newSeeds.bucketSize(i);
+				size_t packBegin = 0, packCost = 0;
 
-						if (rangeVector[xt].oldRange > rangeVector[it].oldRange)
+				walkGroups(i, [&](size_t j, size_t jEnd, size_t x, size_t xEnd, size_t cost)
+				{
+					if (cost <= tileCost || x == xEnd) // With no new seeds to pair with there's nothing to cut up, only searches.
+					{
+						packCost += cost;
+						if (packCost >= tileCost)
 						{
-							removeOverlapEntry(&it);
+							out.push_back({ i, packBegin, jEnd, 0, newSize, packCost });
+							packBegin = jEnd;
+							packCost = 0;
 						}
-						else
+						return;
+					}
+
+					if (packBegin < j)
+						out.push_back({ i, packBegin, j, 0, newSize, packCost });
+
+					// Cut along the old side first. A tile sees its whole share of the new run, so its rangeIndex can throw away
+					// the smaller of two overlapping matches as early as it did before tiling. The new side only gets cut when
+					// there aren't enough old seeds to go around, a handful of old seeds against a huge new run.
+					size_t oldCount = jEnd - j, newCount = xEnd - x;
+					size_t tileCount = (cost + tileCost - 1) / tileCost;
+					size_t oldCuts = std::min(oldCount, tileCount);
+					size_t newCuts = std::min(newCount, (tileCount + oldCuts - 1) / oldCuts);
+
+					for (size_t a = 0; a < oldCuts; a++)
+					{
+						for (size_t b = 0; b < newCuts; b++)
 						{
-							removeOverlapEntry(&xt);
-						}
+							size_t tileOld = j + oldCount * a / oldCuts, tileOldEnd = j + oldCount * (a + 1) / oldCuts;
+							size_t tileNew = x + newCount * b / newCuts, tileNewEnd = x + newCount * (b + 1) / newCuts;
 
+							out.push_back({ i, tileOld, tileOldEnd, tileNew, tileNewEnd, (tileOldEnd - tileOld) * (tileNewEnd - tileNew) });
+						}
 					}
-					else if (valuesOverlap(rangeVector[xt].newRange, rangeVector[it].newRange))
+
+					packBegin = jEnd;
+					packCost = 0;
+				});
+
+				if (packBegin < oldSeeds.bucketSize(i))
+					out.push_back({ i, packBegin, oldSeeds.bucketSize(i), 0, newSize, packCost });
+			});
+		}
+		workers().wait();
+
+		for (auto& out : bucketTiles)
+			tiles.insert(tiles.end(), out.begin(), out.end());
+
+		// Cheapest first. Queues are handed out in turn and each worker runs its own newest task first, so that way every
+		// worker starts on its most expensive tile, and the small ones at the front of each queue are what workers that run
+		// dry steal to fill in the gaps at the end.
+		std::sort(tiles.begin(), tiles.end(), [](const seedTile& a, const seedTile& b) { return a.cost < b.cost; });
+	}
+
+	void dashDiff::findCommonRanges(int i, size_t rangeStart, size_t rangeEnd, size_t newBegin, size_t newEnd)
+	{
+		rangeIndex localRanges;
+		const int worker = workers().currentWorker();
+		taskStatus* status = worker >= 0 ? &taskStatuses[worker] : nullptr; // Nobody can steal from a caller outside the pool.
+
+		if (status != nullptr)
+		{
+			status->splitRequests = 0;
+			status->oldSeedsDone = 0;
+			status->oldSeedsTotal = rangeEnd - rangeStart;
+		}
+
+		seedOffset* oldBucket = oldSeeds.bucketBegin(i);
+		seedOffset* newBucket = newSeeds.bucketBegin(i);
+
+		for (size_t j = rangeStart; j < rangeEnd;)
+		{
+			// Somebody has run out of work, give them the back half of what's left of ours.
+			if (status != nullptr && status->splitRequests > 0)
+			{
+				status->splitRequests--;
+
+				if (rangeEnd - j >= 2)
+				{
+					size_t splitAt = j + (rangeEnd - j) / 2;
+
+					pool->submit([this, i, splitAt, rangeEnd, newBegin, newEnd]() { findCommonRanges(i, splitAt, rangeEnd, newBegin, newEnd); });
+					rangeEnd = splitAt;
+					status->oldSeedsTotal = rangeEnd - rangeStart;
+				}
+			}
+
+			// Both buckets are sorted by k-gram, so the only seeds worth extending are the run of new positions
+			// that share this old position's first minimumMatch bytes, clipped to this tile's share of the new bucket.
+			// The old seeds following this one that share its k-gram share that run too, so take up to a block of them.
+			gramProbe probe = { gramKey(&oldFileBuffer[oldBucket[j]], minimumMatch) };
+			size_t groupEnd = j + 1;
+
+			while (groupEnd < rangeEnd && groupEnd - j < SEEDBLOCKOLD && gramKey(&oldFileBuffer[oldBucket[groupEnd]], minimumMatch) == probe.key)
+				groupEnd++;
+
+			auto gramRun = std::equal_range(newBucket + newBegin, newBucket + newEnd, probe, gramOrder{ newFileBuffer, minimumMatch });
+			size_t runBegin = gramRun.first - newBucket, runEnd = gramRun.second - newBucket;
+
+			// Walking every old seed over the whole run would drag the run's text through the cache once per old seed.
+			// Instead go a slice of the run at a time: the first old seed pulls the slice's text in, prefetching ahead
+			// of itself, and every other old seed in the block finds it still in L1.
+			for (size_t slice = runBegin; slice < runEnd; slice += SEEDBLOCKNEW)
+			{
+				size_t sliceEnd = std::min(runEnd, slice + SEEDBLOCKNEW);
+
+				for (size_t row = j; row < groupEnd; row++)
+				{
+					const char* oldSeed = &oldFileBuffer[oldBucket[row]];
+
+					for (size_t x = slice; x < sliceEnd; x++)
 					{
-						// If this range is bigger than the one we're comparing it to, remove the smaller one.
+						const char* newSeed = &newFileBuffer[newBucket[x]];
 
-						if (rangeVector[xt].newRange > rangeVector[it].newRange)
-						{
-							removeOverlapEntry(&it);
-						}
-						else
-						{
-							removeOverlapEntry(&xt);
-						}
+						if (row == j)
+							prefetchRead(&newFileBuffer[newBucket[std::min(x + SEEDPREFETCH, runEnd - 1)]]);
 
-					}
+						// Every position inside a match is a seed of its own, and extending any of them finds the same match.
+						// If the previous cell on this seed's diagonal (old offset minus new offset) matches too, the seed is
+						// covered by a match that starts earlier on the diagonal. That earlier start is a seed as well, in
+						// whichever bucket its k-gram hashed to, so the match is found once from there and never rediscovered.
+						if (oldSeed > oldFileBuffer && newSeed > newFileBuffer && oldSeed[-1] == newSeed[-1])
+							continue;
+
+						dualRange tempRange = expandMatch(oldSeed, newSeed);
 
+						if (tempRange.rangeSize >= minimumMatch) // 5 for text because the code for S[text] is 4 bytes long as a minimum,
+						{				// 4 for binary. So while we could skip shorter text, it really doesn't save us anything and
+										// just increases the size of the patch file, and computation time.
+							localRanges.insert(tempRange); // Keeps the bigger of anything overlapping on either side.
+						}
+					}
 				}
 			}
+
+			if (status != nullptr)
+			{
+				status->oldSeedsDone.store(groupEnd - rangeStart, std::memory_order_relaxed);
+				status->seedPairs.fetch_add((groupEnd - j) * (runEnd - runBegin), std::memory_order_relaxed);
+			}
+
+			// The next group's old text is wherever its seeds point, get the first of it coming.
+			if (groupEnd < rangeEnd)
+				prefetchRead(&oldFileBuffer[oldBucket[groupEnd]]);
+
+			j = groupEnd;
+		}
+
+		if (localRanges.size() > 0)
+		{
+			// Only this worker ever touches its slot, so there's nothing to lock.
+			std::vector<std::vector<dualRange>>& runs = workerRuns[worker >= 0 ? worker : threadCount];
+
+			runs.emplace_back();
+			localRanges.appendTo(runs.back());
+			matchCount += runs.back().size();
 		}
+
+		if (status != nullptr)
+			status->oldSeedsTotal = 0;
 	}
 
-	differencesReport dashDiff::getReport(void)
+	void dashDiff::progressToConsole(std::chrono::time_point<std::chrono::system_clock> startOperations)
 	{
-		return report;
+		// One cell per worker, past 16 of them the line gets too long for a console so the rest are just counted.
+		for (size_t x = 0; x < std::min<size_t>(threadCount, 16); x++)
+		{
+			size_t total = taskStatuses[x].oldSeedsTotal, done = taskStatuses[x].oldSeedsDone;
+
+			if (total > 0)
+				std::cout << "[" << std::setw(3) << std::min<size_t>(done, total) * 100 / total << "%]";
+			else
+				std::cout << "[___%]";
+		}
+		if (threadCount > 16)
+			std::cout << " +" << threadCount - 16 << " more";
+
+		{
+			const std::chrono::time_point<std::chrono::system_clock> currentOperations = std::chrono::system_clock::now();
+			std::cout << "  Elapsed Time: " << std::chrono::duration_cast<std::chrono::seconds>(currentOperations - startOperations).count();
+
+
+			size_t entriespersecond = 0, pairspersecond = 0, seedPairs = 0;
+
+			for (size_t x = 0; x < threadCount; x++)
+				seedPairs += taskStatuses[x].seedPairs.load(std::memory_order_relaxed);
+
+			if (std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - startOperations).count() > 0)
+			{
+				entriespersecond = matchCount / std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - startOperations).count();
+				pairspersecond = seedPairs / std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - startOperations).count();
+			}
+
+			std::cout << " second(s) {" << entriespersecond << " matches, " << pairspersecond << " seed pairs per second}\r";
+
+		}
+	}
+
+	void dashDiff::dumpBuffersintoArray(void)
+	{
+		const std::chrono::time_point<std::chrono::system_clock> startOperations = std::chrono::system_clock::now();
+
+		if (oldFileBufferSize > std::numeric_limits<seedOffset>::max() || newFileBufferSize > std::numeric_limits<seedOffset>::max())
+		{
+			std::cout << "dashDiff::dumpBuffersintoArray(): Files are too large for 32 bit seed offsets, rebuild with DASHDIFF_LARGEFILES." << std::endl;
+			exit(-1);
+		}
+
+		buildSeedIndex(oldSeeds, oldFileBuffer, oldFileBufferSize);
+		buildSeedIndex(newSeeds, newFileBuffer, newFileBufferSize);
+		matchCount = 0;
+		for (size_t x = 0; x < threadCount; x++)
+			taskStatuses[x].seedPairs = 0;
+
+		// Queue every tile up front, workers that run dry steal from each other and split whatever is still running.
+		std::vector<seedTile> tiles;
+
+		planSeedTiles(tiles);
+
+		// From here on every seed pair lands somewhere different in both files, read ahead would only waste I/O.
+		oldFile.advise(accessPattern::random);
+		newFile.advise(accessPattern::random);
+		for (const seedTile& tile : tiles)
+			workers().submit([this, tile]() { findCommonRanges(tile.bucket, tile.oldBegin, tile.oldEnd, tile.newBegin, tile.newEnd); });
+
+		// Wakes as soon as the last task finishes, the timeout only sets how often the progress line is redrawn.
+		while (!workers().waitFor(std::chrono::milliseconds(PROGRESSINTERVAL)))
+			progressToConsole(startOperations);
+
+		// Every task has left its matches behind, gather them up and put them in order once.
+		mergeRuns();
+		chainRanges();
+		reduceOverlaps();
 	}
 
-	void dashDiff::findCommonRanges(int i, int athread, int rangeStart, int rangeEnd)
-	{
-		std::vector<dualRange> localRangeVector;
+	uint64_t dashDiff::gramKey(const char* position, size_t length)
+	{
+		uint64_t key = 0;
+
+		// Big endian so comparing keys orders k-grams the same way memcmp would.
+		for (size_t i = 0; i < length; i++)
+			key = (key << 8) | (unsigned char)position[i];
+
+		return key;
+	}
+
+	int dashDiff::gramBucket(const char* position, size_t length)
+	{
+		// Multiplicative hash, the top byte picks one of the 256 buckets.
+		return (int)((gramKey(position, length) * 0x9E3779B97F4A7C15ull) >> 56);
+	}
+
+	void dashDiff::buildSeedIndex(seedIndex& index, const char* buffer, size_t bufferSize)
+	{
+		// Every position is keyed by the minimumMatch bytes starting there, the last few positions can't start
+		// a useful match so they're never indexed.
+		const size_t gramLength = minimumMatch;
+		const size_t seedCount = bufferSize >= gramLength ? bufferSize - gramLength + 1 : 0;
+		const size_t chunkCount = std::max<size_t>(1, std::min<size_t>(workers().size(), seedCount / 65536));
+		std::vector<std::array<size_t, 256>> chunkCursor(chunkCount);
+
+		auto chunkBounds = [&](size_t chunk, size_t& start, size_t& end)
+		{
+			start = seedCount * chunk / chunkCount;
+			end = seedCount * (chunk + 1) / chunkCount;
+		};
+
+		// First pass, each chunk of the file counts how many of its seeds land in each bucket.
+		for (size_t chunk = 0; chunk < chunkCount; chunk++)
+		{
+			workers().submit([&, chunk]()
+			{
+				size_t start, end;
+
+				chunkBounds(chunk, start, end);
+				chunkCursor[chunk].fill(0);
+				for (size_t i = start; i < end; i++)
+					chunkCursor[chunk][gramBucket(&buffer[i], gramLength)]++;
+			});
+		}
+		workers().wait();
+
+		// Prefix sum over (bucket, chunk) turns the counts into where each chunk writes inside each bucket,
+		// so the whole index is one allocation and every bucket keeps its seeds in file order.
+		size_t running = 0;
+		for (int bucket = 0; bucket < 256; bucket++)
+		{
+			index.bucketStart[bucket] = running;
+			for (size_t chunk = 0; chunk < chunkCount; chunk++)
+			{
+				size_t chunkSeeds = chunkCursor[chunk][bucket];
+
+				chunkCursor[chunk][bucket] = running;
+				running += chunkSeeds;
+			}
+		}
+		index.bucketStart[256] = running;
+		index.offsets.resize(seedCount);
+
+		// Second pass scatters the seeds into place.
+		for (size_t chunk = 0; chunk < chunkCount; chunk++)
+		{
+			workers().submit([&, chunk]()
+			{
+				size_t start, end;
+
+				chunkBounds(chunk, start, end);
+				for (size_t i = start; i < end; i++)
+					index.offsets[chunkCursor[chunk][gramBucket(&buffer[i], gramLength)]++] = (seedOffset)i;
+			});
+		}
+		workers().wait();
+
+		// Different k-grams share a bucket, so order each one by k-gram to make every run of equal k-grams contiguous.
+		// Ties go by offset so the order is the same however the work was split up.
+		for (int bucket = 0; bucket < 256; bucket++)
+		{
+			if (index.bucketSize(bucket) < 2)
+				continue;
+
+			workers().submit([&index, buffer, bucket, gramLength]()
+			{
+				std::sort(index.bucketBegin(bucket), index.bucketEnd(bucket), [buffer, gramLength](seedOffset a, seedOffset b)
+				{
+					uint64_t keyA = gramKey(buffer + a, gramLength), keyB = gramKey(buffer + b, gramLength);
+					return keyA < keyB || (keyA == keyB && a < b);
+				});
+			});
+		}
+		workers().wait();
+	}
+
+	dualRange dashDiff::makeRange(const char* oldStart, const char* newStart, size_t length)
+	{
+		dualRange response;
+
+		response.rangeSize = length;
+		response.oldRange.start = response.oldRange.reference = oldStart;
+		response.oldRange.end = oldStart + length;
+		response.oldRange.min = oldFileBuffer;
+		response.oldRange.max = &oldFileBuffer[oldFileBufferSize - 1];
+		response.newRange.start = response.newRange.reference = newStart;
+		response.newRange.end = newStart + length;
+		response.newRange.min = newFileBuffer;
+		response.newRange.max = &newFileBuffer[newFileBufferSize - 1];
+
+		return response;
+	}
+
+	dualRange dashDiff::expandMatch(const char* oldSeed, const char* newSeed)
+	{
+		size_t oldLeft = oldSeed - oldFileBuffer, newLeft = newSeed - newFileBuffer;
+		size_t oldRight = oldFileBufferSize - oldLeft, newRight = newFileBufferSize - newLeft;
+
+		// Expand to the left as much as we can while each character matches, then to the right, the seed itself included.
+		// The kernels compare a whole vector register per step, so long matches don't crawl along a byte at a time.
+		size_t left = matchBackward(oldSeed, newSeed, std::min(oldLeft, newLeft));
+		size_t right = matchForward(oldSeed, newSeed, std::min(oldRight, newRight));
+
+		return makeRange(oldSeed - left, newSeed - left, left + right);
+	}
+
+	void dashDiff::findCommonRangesRollingHash(void)
+	{
+		const size_t blockSize = ROLLINGHASHBLOCK;
+		const uint64_t base = 0x100000001B3ull; // Odd, so it's invertible mod 2^64, we let the arithmetic wrap.
+		uint64_t outgoingFactor = 1; // base^(blockSize - 1), to remove the byte leaving the window.
+		std::vector<std::pair<uint64_t, size_t>> blockIndex;
+
+		if (oldFileBufferSize < blockSize || newFileBufferSize < blockSize)
+			return;
+
+		for (size_t i = 1; i < blockSize; i++)
+			outgoingFactor *= base;
+
+		auto hashBlock = [&](const char* block) -> uint64_t
+		{
+			uint64_t hash = 0;
+			for (size_t i = 0; i < blockSize; i++)
+				hash = hash * base + (unsigned char)block[i];
+			return hash;
+		};
+
+		// Index the old file on fixed block boundaries, rsync style. Sorted so a lookup is a binary search.
+		blockIndex.reserve(oldFileBufferSize / blockSize);
+		for (size_t offset = 0; offset + blockSize <= oldFileBufferSize; offset += blockSize)
+			blockIndex.push_back({ hashBlock(&oldFileBuffer[offset]), offset });
+		std::sort(blockIndex.begin(), blockIndex.end());
+
+		// Then slide over every position of the new file once. A verified hit is grown with expandMatch and we jump
+		// straight past it, so long shared stretches cost one hash per block instead of one per byte.
+		size_t position = 0;
+		uint64_t hash = hashBlock(newFileBuffer);
+
+		while (position + blockSize <= newFileBufferSize)
+		{
+			auto hits = std::equal_range(blockIndex.begin(), blockIndex.end(), std::make_pair(hash, (size_t)0),
+				[](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) { return a.first < b.first; });
+			dualRange best;
+			int tested = 0;
+
+			best.rangeSize = 0;
+			for (auto hit = hits.first; hit != hits.second && tested < ROLLINGHASHCANDIDATES; hit++, tested++)
+			{
+				if (memcmp(&oldFileBuffer[hit->second], &newFileBuffer[position], blockSize) != 0)
+					continue; // Hash collision.
+
+				dualRange candidate = expandMatch(&oldFileBuffer[hit->second], &newFileBuffer[position]);
+
+				if (candidate.rangeSize > best.rangeSize)
+					best = candidate;
+			}
+
+			if (best.rangeSize > 0)
+			{
+				rangeVector.push_back(best);
+
+				position = best.newRange.end - newFileBuffer;
+				if (position + blockSize <= newFileBufferSize)
+					hash = hashBlock(&newFileBuffer[position]);
+				continue;
+			}
+
+			// Roll the window forward one byte.
+			if (position + blockSize < newFileBufferSize)
+				hash = (hash - (unsigned char)newFileBuffer[position] * outgoingFactor) * base + (unsigned char)newFileBuffer[position + blockSize];
+			position++;
+		}
+
+		// Hits are in new file order but can land anywhere in the old one, so crossings and overlaps still need sorting out.
+		chainRanges();
+		reduceOverlaps();
+	}
+
+	void dashDiff::buildLineTable(lineTable& lines)
+	{
+		std::unordered_map<std::string_view, unsigned int> lineIds;
+
+		auto splitLines = [&](const char* buffer, size_t bufferSize, std::vector<unsigned int>& ids, std::vector<const char*>& starts)
+		{
+			const char* position = buffer;
+			const char* end = buffer + bufferSize;
+
+			while (position < end)
+			{
+				const char* newline = (const char*)memchr(position, '\n', end - position);
+				const char* lineEnd = newline ? newline + 1 : end;
+
+				// First time we see a line it gets the next id, after that it's a lookup.
+				auto id = lineIds.emplace(std::string_view(position, lineEnd - position), (unsigned int)lineIds.size());
+
+				ids.push_back(id.first->second);
+				starts.push_back(position);
+				position = lineEnd;
+			}
+			starts.push_back(end);
+		};
+
+		splitLines(oldFileBuffer, oldFileBufferSize, lines.oldLines, lines.oldLineStart);
+		splitLines(newFileBuffer, newFileBufferSize, lines.newLines, lines.newLineStart);
+	}
+
+	void dashDiff::myersLines(lineTable& lines, size_t oldStart, size_t oldEnd, size_t newStart, size_t newEnd,
+		std::vector<ptrdiff_t>& forward, std::vector<ptrdiff_t>& reverse, std::vector<std::pair<size_t, size_t>>& matchedLines)
+	{
+		const unsigned int* a = lines.oldLines.data() + oldStart;
+		const unsigned int* b = lines.newLines.data() + newStart;
+		const size_t oldSuffixEnd = oldEnd;
+
+		// Strip the common prefix and suffix. They match by definition, and it's what guarantees the
+		// middle snake below always splits the problem into two strictly smaller ones.
+		while (oldStart < oldEnd && newStart < newEnd && *a == *b)
+		{
+			matchedLines.push_back({ oldStart++, newStart++ });
+			a++;
+			b++;
+		}
+		while (oldStart < oldEnd && newStart < newEnd && a[oldEnd - oldStart - 1] == b[newEnd - newStart - 1])
+		{
+			oldEnd--;
+			newEnd--;
+		}
+
+		const ptrdiff_t n = oldEnd - oldStart;
+		const ptrdiff_t m = newEnd - newStart;
+
+		if (n > 0 && m > 0)
+		{
+			// Find the middle snake, running the forward and reverse searches towards each other one edit at a time.
+			// Only the furthest reaching x per diagonal is kept, so this is linear space no matter how far apart the files are.
+			const ptrdiff_t maxD = (n + m + 1) / 2;
+			const ptrdiff_t offset = maxD;
+			const ptrdiff_t length = 2 * maxD + 2;
+			const ptrdiff_t delta = n - m;
+			const bool oddDelta = (delta & 1) != 0;
+			ptrdiff_t forwardStart = 0, forwardEnd = 0, reverseStart = 0, reverseEnd = 0;
+			ptrdiff_t splitX = -1, splitY = -1;
+
+			std::fill(forward.begin(), forward.begin() + length, -1);
+			std::fill(reverse.begin(), reverse.begin() + length, -1);
+			forward[offset + 1] = 0;
+			reverse[offset + 1] = 0;
+
+			for (ptrdiff_t d = 0; d < maxD && splitX < 0; d++)
+			{
+				for (ptrdiff_t k = -d + forwardStart; k <= d - forwardEnd; k += 2)
+				{
+					ptrdiff_t x = (k == -d || (k != d && forward[offset + k - 1] < forward[offset + k + 1])) ? forward[offset + k + 1] : forward[offset + k - 1] + 1;
+					ptrdiff_t y = x - k;
+
+					while (x < n && y < m && a[x] == b[y])
+					{
+						x++;
+						y++;
+					}
+					forward[offset + k] = x;
+
+					if (x > n)
+						forwardEnd += 2; // Ran off the right of the grid.
+					else if (y > m)
+						forwardStart += 2; // Ran off the bottom of the grid.
+					else if (oddDelta)
+					{
+						ptrdiff_t reverseK = offset + delta - k;
+
+						if (reverseK >= 0 && reverseK < length && reverse[reverseK] != -1 && x >= n - reverse[reverseK])
+						{
+							splitX = x;
+							splitY = y;
+							break;
+						}
+					}
+				}
+
+				if (splitX >= 0)
+					break;
+
+				for (ptrdiff_t k = -d + reverseStart; k <= d - reverseEnd; k += 2)
+				{
+					ptrdiff_t x = (k == -d || (k != d && reverse[offset + k - 1] < reverse[offset + k + 1])) ? reverse[offset + k + 1] : reverse[offset + k - 1] + 1;
+					ptrdiff_t y = x - k;
+
+					while (x < n && y < m && a[n - x - 1] == b[m - y - 1])
+					{
+						x++;
+						y++;
+					}
+					reverse[offset + k] = x;
+
+					if (x > n)
+						reverseEnd += 2;
+					else if (y > m)
+						reverseStart += 2;
+					else if (!oddDelta)
+					{
+						ptrdiff_t forwardK = offset + delta - k;
+
+						if (forwardK >= 0 && forwardK < length && forward[forwardK] != -1)
+						{
+							ptrdiff_t forwardX = forward[forwardK];
+
+							if (forwardX >= n - x)
+							{
+								splitX = forwardX;
+								splitY = forwardX - (forwardK - offset);
+								break;
+							}
+						}
+					}
+				}
+			}
+
+			// No overlap means nothing in common, the whole box is deletes and inserts.
+			if (splitX >= 0)
+			{
+				myersLines(lines, oldStart, oldStart + splitX, newStart, newStart + splitY, forward, reverse, matchedLines);
+				myersLines(lines, oldStart + splitX, oldEnd, newStart + splitY, newEnd, forward, reverse, matchedLines);
+			}
+		}
+
+		// And finally the suffix we stripped, it comes after everything in the middle.
+		while (oldEnd < oldSuffixEnd)
+			matchedLines.push_back({ oldEnd++, newEnd++ });
+	}
+
+	void dashDiff::lineMatchesToRanges(lineTable& lines, std::vector<std::pair<size_t, size_t>>& matchedLines)
+	{
+		// Runs of lines that follow each other on both sides are one range. Matching lines are identical,
+		// so the byte length of the run is the same in both files.
+		for (size_t i = 0; i < matchedLines.size();)
+		{
+			size_t runEnd = i + 1;
+
+			while (runEnd < matchedLines.size() &&
+				matchedLines[runEnd].first == matchedLines[runEnd - 1].first + 1 &&
+				matchedLines[runEnd].second == matchedLines[runEnd - 1].second + 1)
+				runEnd++;
+
+			const char* oldStart = lines.oldLineStart[matchedLines[i].first];
+			const char* newStart = lines.newLineStart[matchedLines[i].second];
+			size_t length = lines.oldLineStart[matchedLines[runEnd - 1].first + 1] - oldStart;
+
+			if (length >= minimumMatch) // Same minimum as findCommonRanges.
+				rangeVector.push_back(makeRange(oldStart, newStart, length));
+
+			i = runEnd;
+		}
+	}
+
+	void dashDiff::findCommonRangesMyers(void)
+	{
+		lineTable lines;
+		std::vector<std::pair<size_t, size_t>> matchedLines;
+
+		buildLineTable(lines);
+
+		// The V arrays are shared down the recursion, sized for the biggest (top level) problem.
+		std::vector<ptrdiff_t> forward(lines.oldLines.size() + lines.newLines.size() + 4);
+		std::vector<ptrdiff_t> reverse(forward.size());
+
+		myersLines(lines, 0, lines.oldLines.size(), 0, lines.newLines.size(), forward, reverse, matchedLines);
+		lineMatchesToRanges(lines, matchedLines);
+
+		// The edit script is already in order on both sides, nothing to resolve.
+	}
+
+	void dashDiff::histogramLines(lineTable& lines, size_t oldStart, size_t oldEnd, size_t newStart, size_t newEnd, size_t spareThreads,
+		std::vector<std::pair<size_t, size_t>>& matchedLines)
+	{
+		const unsigned int* a = lines.oldLines.data();
+		const unsigned int* b = lines.newLines.data();
+
+		// The region right of each anchor is handled by looping rather than recursing, so the stack only grows
+		// with the left hand gaps.
+		while (oldStart < oldEnd && newStart < newEnd)
+		{
+			// Histogram of the old side of this region. Each line id keeps its occurrence count and its first
+			// position, further positions are chained through nextOccurrence.
+			std::unordered_map<unsigned int, std::pair<size_t, size_t>> histogram;
+			std::vector<size_t> nextOccurrence(oldEnd - oldStart);
+
+			for (size_t i = oldEnd; i-- > oldStart;)
+			{
+				auto& entry = histogram.try_emplace(a[i], SIZE_MAX, 0).first->second;
+
+				nextOccurrence[i - oldStart] = entry.first;
+				entry.first = i;
+				entry.second++;
+			}
+
+			// Find the anchor, the common run containing the lowest occurrence lines, and the longest among those.
+			size_t anchorOld = 0, anchorNew = 0, anchorLength = 0;
+			size_t anchorCount = HISTOGRAMMAXCHAIN; // Anything occurring more often is skipped outright.
+
+			for (size_t j = newStart; j < newEnd;)
+			{
+				auto entry = histogram.find(b[j]);
+				size_t nextJ = j + 1;
+
+				if (entry != histogram.end() && entry->second.second <= anchorCount)
+				{
+					for (size_t i = entry->second.first; i != SIZE_MAX; i = nextOccurrence[i - oldStart])
+					{
+						size_t runOld = i, runNew = j, runEnd = i + 1;
+						size_t runCount = entry->second.second;
+
+						while (runOld > oldStart && runNew > newStart && a[runOld - 1] == b[runNew - 1])
+						{
+							runOld--;
+							runNew--;
+							runCount = std::min(runCount, histogram[a[runOld]].second);
+						}
+						while (runEnd < oldEnd && runNew + (runEnd - runOld) < newEnd && a[runEnd] == b[runNew + (runEnd - runOld)])
+						{
+							runCount = std::min(runCount, histogram[a[runEnd]].second);
+							runEnd++;
+						}
+
+						nextJ = std::max(nextJ, runNew + (runEnd - runOld));
+
+						if (runEnd - runOld > anchorLength || runCount < anchorCount)
+						{
+							anchorOld = runOld;
+							anchorNew = runNew;
+							anchorLength = runEnd - runOld;
+							anchorCount = runCount;
+						}
+					}
+				}
+
+				j = nextJ;
+			}
+
+			if (anchorLength == 0)
+			{
+				// Nothing rare enough to anchor on, fall back to a plain Myers diff of what's left.
+				std::vector<ptrdiff_t> forward((oldEnd - oldStart) + (newEnd - newStart) + 4);
+				std::vector<ptrdiff_t> reverse(forward.size());
+
+				myersLines(lines, oldStart, oldEnd, newStart, newEnd, forward, reverse, matchedLines);
+				return;
+			}
+
+			// The gaps either side of the anchor are independent problems. While there are threads to spare, big ones
+			// go to their own thread while this one carries on with the right hand side, and the rest of the spare
+			// threads are split between the two.
+			if (spareThreads > 0 && anchorOld - oldStart + anchorNew - newStart >= HISTOGRAMPARALLELLINES &&
+				oldEnd - anchorOld + newEnd - anchorNew >= HISTOGRAMPARALLELLINES)
+			{
+				std::vector<std::pair<size_t, size_t>> leftMatches, rightMatches;
+				size_t leftSpare = (spareThreads - 1) / 2;
+				std::thread leftThread(&dashDiff::histogramLines, this, std::ref(lines), oldStart, anchorOld, newStart, anchorNew, leftSpare, std::ref(leftMatches));
+
+				histogramLines(lines, anchorOld + anchorLength, oldEnd, anchorNew + anchorLength, newEnd, spareThreads - 1 - leftSpare, rightMatches);
+				leftThread.join();
+
+				matchedLines.insert(matchedLines.end(), leftMatches.begin(), leftMatches.end());
+				for (size_t i = 0; i < anchorLength; i++)
+					matchedLines.push_back({ anchorOld + i, anchorNew + i });
+				matchedLines.insert(matchedLines.end(), rightMatches.begin(), rightMatches.end());
+				return;
+			}
+
+			histogramLines(lines, oldStart, anchorOld, newStart, anchorNew, spareThreads, matchedLines);
+			for (size_t i = 0; i < anchorLength; i++)
+				matchedLines.push_back({ anchorOld + i, anchorNew + i });
+
+			oldStart = anchorOld + anchorLength;
+			newStart = anchorNew + anchorLength;
+		}
+	}
+
+	void dashDiff::findCommonRangesHistogram(void)
+	{
+		lineTable lines;
+		std::vector<std::pair<size_t, size_t>> matchedLines;
+
+		buildLineTable(lines);
+		histogramLines(lines, 0, lines.oldLines.size(), 0, lines.newLines.size(), threadCount - 1, matchedLines);
+		lineMatchesToRanges(lines, matchedLines);
+	}
+
+	void dashDiff::buildSuffixArray(std::vector<unsigned int>& suffixArray, std::vector<unsigned int>& lcpArray)
+	{
+		// The text is old file + separator + new file. Bytes are shifted up by one so the separator (0) is unique
+		// and no common substring can ever run across the boundary between the two files.
+		const size_t textSize = oldFileBufferSize + 1 + newFileBufferSize;
+		auto symbol = [&](size_t position) -> unsigned int
+		{
+			if (position < oldFileBufferSize)
+				return (unsigned char)oldFileBuffer[position] + 1;
+			if (position == oldFileBufferSize)
+				return 0;
+			return (unsigned char)newFileBuffer[position - oldFileBufferSize - 1] + 1;
+		};
+
+		std::vector<unsigned int> rank(textSize), work(textSize), count(std::max<size_t>(textSize, 257) + 1);
+
+		suffixArray.resize(textSize);
+
+		// Prefix doubling. Each round sorts suffixes by their first 2k symbols using two counting sort passes,
+		// so the whole build is O(n log n) no matter how repetitive the input is.
+		for (size_t i = 0; i < textSize; i++)
+		{
+			rank[i] = symbol(i);
+			count[rank[i]]++;
+		}
+		for (size_t i = 1; i < count.size(); i++)
+			count[i] += count[i - 1];
+		for (size_t i = textSize; i-- > 0;)
+			suffixArray[--count[rank[i]]] = (unsigned int)i;
+
+		size_t classes = 257;
+
+		for (size_t k = 1; k < textSize; k <<= 1)
+		{
+			size_t p = 0;
+
+			// Order by the second half first: suffixes running off the end sort before everything else.
+			for (size_t i = textSize - k; i < textSize; i++)
+				work[p++] = (unsigned int)i;
+			for (size_t i = 0; i < textSize; i++)
+			{
+				if (suffixArray[i] >= k)
+					work[p++] = suffixArray[i] - (unsigned int)k;
+			}
+
+			// Then a stable counting sort on the first half.
+			std::fill(count.begin(), count.begin() + classes + 1, 0);
+			for (size_t i = 0; i < textSize; i++)
+				count[rank[i]]++;
+			for (size_t i = 1; i <= classes; i++)
+				count[i] += count[i - 1];
+			for (size_t i = textSize; i-- > 0;)
+				suffixArray[--count[rank[work[i]]]] = work[i];
+
+			// Re-rank, suffixes only share a rank if both halves match.
+			work[suffixArray[0]] = 0;
+			for (size_t i = 1; i < textSize; i++)
+			{
+				unsigned int current = suffixArray[i], previous = suffixArray[i - 1];
+				bool same = rank[current] == rank[previous] &&
+					(current + k < textSize ? (int)rank[current + k] : -1) == (previous + k < textSize ? (int)rank[previous + k] : -1);
+
+				work[current] = work[previous] + (same ? 0 : 1);
+			}
+			rank.swap(work);
+			classes = rank[suffixArray[textSize - 1]] + 1;
+
+			if (classes == textSize)
+				break; // Every suffix is distinct, we're sorted.
+		}
+
+		// Kasai's algorithm, lcpArray[i] is the common prefix length of suffixArray[i - 1] and suffixArray[i].
+		for (size_t i = 0; i < textSize; i++)
+			rank[suffixArray[i]] = (unsigned int)i;
+
+		lcpArray.assign(textSize, 0);
+
+		size_t h = 0;
+		for (size_t i = 0; i < textSize; i++)
+		{
+			if (rank[i] == 0)
+			{
+				h = 0;
+				continue;
+			}
+
+			size_t j = suffixArray[rank[i] - 1];
+			while (i + h < textSize && j + h < textSize && symbol(i + h) == symbol(j + h))
+				h++;
+
+			lcpArray[rank[i]] = (unsigned int)h;
+
+			if (h > 0)
+				h--;
+		}
+	}
+
+	void dashDiff::findCommonRangesSuffixArray(void)
+	{
+		std::vector<unsigned int> suffixArray, lcpArray;
+
+		if (oldFileBufferSize == 0 || newFileBufferSize == 0)
+			return;
+
+		if (oldFileBufferSize + 1 + newFileBufferSize >= UINT_MAX)
+		{
+			std::cout << "dashDiff::findCommonRangesSuffixArray(): Files are too large for the suffix array engine." << std::endl;
+			exit(-1);
+		}
+
+		buildSuffixArray(suffixArray, lcpArray);
+
+		// Neighbouring suffixes that come from different files share their longest common prefix with each other,
+		// so every adjacent old/new pair is a right-maximal match. Only keep the left-maximal ones, anything else
+		// is just the tail end of a bigger match that we'll emit from its true start.
+		for (size_t i = 1; i < suffixArray.size(); i++)
+		{
+			size_t a = suffixArray[i - 1], b = suffixArray[i];
+			size_t length = lcpArray[i];
+
+			if (length < minimumMatch) // Same minimum as findCommonRanges.
+				continue;
+			if ((a < oldFileBufferSize) == (b < oldFileBufferSize))
+				continue; // Both suffixes are from the same file.
+
+			size_t oldOffset = std::min(a, b);
+			size_t newOffset = std::max(a, b) - oldFileBufferSize - 1;
+
+			if (oldOffset > 0 && newOffset > 0 && oldFileBuffer[oldOffset - 1] == newFileBuffer[newOffset - 1])
+				continue;
+
+			rangeVector.push_back(makeRange(&oldFileBuffer[oldOffset], &newFileBuffer[newOffset], length));
+		}
+
+		chainRanges();
+		reduceOverlaps();
+	}
+
+	void dashDiff::setMatchEngine(matchEngine aEngine)
+	{
+		engine = aEngine;
+	}
+
+	void dashDiff::setMemoryMapping(bool aUseMapping)
+	{
+		useMapping = aUseMapping;
+	}
+
+	void dashDiff::setMemoryBudget(size_t aMemoryBudget)
+	{
+		memoryBudget = aMemoryBudget;
+	}
+
+	bool dashDiff::isStreaming(void)
+	{
+		return memoryBudget > 0;
+	}
+
+	size_t dashDiff::streamingBuffers(void)
+	{
+		return PATCHBUFFERSIZE + (format == patchFormat::binary ? CHECKSUMBLOCK : 0);
+	}
+
+	void dashDiff::setPatchFormat(patchFormat aFormat)
+	{
+		format = aFormat;
+		minimumMatch = format == patchFormat::binary ? BINARYMINIMUMMATCH : MINIMUMMATCH;
+	}
+
+	void dashDiff::setThreadCount(size_t aThreadCount)
+	{
+		// The pool is sized when it starts, so drop any running one and let the next user start it at the new size.
+		pool.reset();
+		taskStatuses.reset();
+		threadCount = std::max<size_t>(1, aThreadCount);
+	}
+
+	void dashDiff::findMatches(void)
+	{
+		// Small edits in big files are the common case, so before any engine gets going strip off whatever the files
+		// share at the start and the end. They go straight in as S ranges and the engine only sees the middle.
+		size_t commonLength = std::min(oldFileBufferSize, newFileBufferSize);
+		size_t prefix = matchForward(oldFileBuffer, newFileBuffer, commonLength);
+		size_t suffix = matchBackward(oldFileBuffer + oldFileBufferSize, newFileBuffer + newFileBufferSize, commonLength - prefix);
+
+		if (prefix < minimumMatch)
+			prefix = 0; // Not worth a S[n] of its own, leave it to the engine.
+		if (suffix < minimumMatch)
+			suffix = 0;
+
+		const char* oldFull = oldFileBuffer, * newFull = newFileBuffer;
+		size_t oldFullSize = oldFileBufferSize, newFullSize = newFileBufferSize;
+
+		// The engines work off oldFileBuffer / newFileBuffer, so narrow them to the middle for the duration.
+		// Everything they emit points into the same memory, so the ranges stay valid once the full view is back.
+		oldFileBuffer += prefix;
+		newFileBuffer += prefix;
+		oldFileBufferSize -= prefix + suffix;
+		newFileBufferSize -= prefix + suffix;
+
+		if (oldFileBufferSize > 0 && newFileBufferSize > 0)
+			runMatchEngine();
+
+		oldFileBuffer = oldFull;
+		newFileBuffer = newFull;
+		oldFileBufferSize = oldFullSize;
+		newFileBufferSize = newFullSize;
+
+		if (prefix > 0)
+			rangeVector.insert(rangeVector.begin(), makeRange(oldFileBuffer, newFileBuffer, prefix));
+		if (suffix > 0)
+			rangeVector.push_back(makeRange(oldFileBuffer + oldFileBufferSize - suffix, newFileBuffer + newFileBufferSize - suffix, suffix));
+	}
+
+	void dashDiff::runMatchEngine(void)
+	{
+		switch (engine)
+		{
+		case matchEngine::suffixArray:
+			findCommonRangesSuffixArray();
+			break;
+		case matchEngine::rollingHash:
+			findCommonRangesRollingHash();
+			break;
+		case matchEngine::myersLines:
+			findCommonRangesMyers();
+			break;
+		case matchEngine::histogramLines:
+			findCommonRangesHistogram();
+			break;
+		case matchEngine::byteBuckets:
+		default:
+			dumpBuffersintoArray();
+			break;
+		}
+	}
+
+	void dashDiff::sortRanges(void)
+	{
+		// Sort the ranges by the start of the old range.
+		std::sort(rangeVector.begin(), rangeVector.end());
+	}
+
+	void dashDiff::readIntoBuffers(void)
+	{
+		// Check if the files are open.
+		if (!oldFile.isOpen() || !newFile.isOpen())
+		{
+			std::cout << "dashDiff::dashDiff.readIntoBuffers(): Files are not open for reading." << std::endl;
+			exit(-1);
+		}
+
+		// Nothing to read, the buffers are the files. Mapped pages come in as they're first touched.
+		oldFileBuffer = oldFile.data();
+		oldFileBufferSize = oldFile.size();
+		newFileBuffer = newFile.data();
+		newFileBufferSize = newFile.size();
+
+		// The prefix and suffix scans and the seed index builds all stream through the files front to back.
+		oldFile.advise(accessPattern::sequential);
+		newFile.advise(accessPattern::sequential);
+
+		// Captain, Captain, ready to rip.
+	}
+
+	bool dashDiff::openForComparison(const char* oldFilePath, const char* newFilePath)
+	{
+		report = { 0, 0, 0, 0, 0 };
+
+		// If either file failed to open, return false.
+		if (!oldFile.open(oldFilePath, useMapping) || !newFile.open(newFilePath, useMapping))
+		{
+			return false;
+		}
+
+		// The patch header names them as they were given to us.
+		this->oldFilePath = oldFilePath;
+		this->newFilePath = newFilePath;
+		return true;
+	}
+
+	uint64_t dashDiff::checksumBuffer(const char* data, size_t length)
+	{
+		// The blocks are independent, so hash them all at once and fold them together in order afterwards.
+		const size_t blockCount = (length + CHECKSUMBLOCK - 1) / CHECKSUMBLOCK;
+		std::vector<uint64_t> blockHashes(blockCount);
+		patchChecksum checksum;
+
+		for (size_t block = 0; block < blockCount; block++)
+		{
+			workers().submit([&, block]()
+			{
+				size_t start = block * CHECKSUMBLOCK;
+
+				blockHashes[block] = patchChecksum::hashBlock(&data[start], std::min<size_t>(CHECKSUMBLOCK, length - start));
+			});
+		}
+		workers().wait();
+
+		for (size_t block = 0; block < blockCount; block++)
+			checksum.combine(blockHashes[block], std::min<size_t>(CHECKSUMBLOCK, length - block * CHECKSUMBLOCK));
+
+		return checksum.value();
+	}
+
+	void dashDiff::writeToPatchFile(std::fstream* afileStream)
+	{
+		// The patch is written front to back through both files.
+		oldFile.advise(accessPattern::sequential);
+		newFile.advise(accessPattern::sequential);
+
+		patchWriter patch(afileStream, format);
+		const char* oldFilePointer = oldFileBuffer;
+		const char* newFilePointer = newFileBuffer;
+
+		report.oldFileSize = oldFileBufferSize;
+		report.newFileSize = newFileBufferSize;
+
+		// Only the binary header has room for the checksums, don't spend the time on them otherwise.
+		if (format == patchFormat::binary)
+			patch.writeHeader({ oldFilePath, newFilePath, oldFileBufferSize, newFileBufferSize,
+				checksumBuffer(oldFileBuffer, oldFileBufferSize), checksumBuffer(newFileBuffer, newFileBufferSize), true });
+		else
+			patch.writeHeader({ oldFilePath, newFilePath, oldFileBufferSize, newFileBufferSize, 0, 0, false });
+
+		for (size_t i = 0; i < rangeVector.size(); i++)
+		{
+			// Delete everything in the old file before the range.
+			if (oldFilePointer != rangeVector[i].oldRange.start)
+			{
+				patch.deleteBytes(rangeVector[i].oldRange.start - oldFilePointer);
+				report.deletedCharacters += rangeVector[i].oldRange.start - oldFilePointer;
+				oldFilePointer = rangeVector[i].oldRange.start;
+			}
+			// Add everything in the new file before the range.
+			if (newFilePointer != rangeVector[i].newRange.start)
+			{
+				patch.insertBytes(newFilePointer, rangeVector[i].newRange.start - newFilePointer);
+				report.insertedCharacters += rangeVector[i].newRange.start - newFilePointer;
+				newFilePointer = rangeVector[i].newRange.start;
+			}
+			// Skip the range
+			patch.copyBytes(rangeVector[i].oldRange.end - rangeVector[i].oldRange.start);
+			oldFilePointer = rangeVector[i].oldRange.end;
+			newFilePointer = rangeVector[i].newRange.end;
+			report.sameCharacters += rangeVector[i].oldRange.end - rangeVector[i].oldRange.start;
+		}
+		// Print the rest of the old file.
+		if (oldFilePointer != &oldFileBuffer[oldFileBufferSize])
+		{
+			patch.deleteBytes(&oldFileBuffer[oldFileBufferSize] - oldFilePointer);
+			report.deletedCharacters += &oldFileBuffer[oldFileBufferSize] - oldFilePointer;
+		}
+		// Print the rest of the new file.
+		if (newFilePointer != &newFileBuffer[newFileBufferSize])
+		{
+			patch.insertBytes(newFilePointer, &newFileBuffer[newFileBufferSize] - newFilePointer);
+			report.insertedCharacters += &newFileBuffer[newFileBufferSize] - newFilePointer;
+		}
+
+		patch.finish();
+	}
+
+	bool dashDiff::streamToPatchFile(const char* oldFilePath, const char* newFilePath, std::fstream* afileStream)
+	{
+		// The in memory engines hold both files and tens of bytes of index per byte, this holds neither. The old file is
+		// mapped, so it lives in the page cache rather than our memory, and gets a rolling hash index of fixed blocks sized
+		// to half the budget. The new file is read through a window the size of the other half. Matches are found greedily
+		// in new file order and written out as soon as they're found, so the ranges never have to be kept either. Greedy means
+		// a match has to land after the last one in the old file, moved blocks are found but only ones that move forward.
+		// Reading the old file into a buffer would tie memory to its size again, so it has to be mapped. The patch writer's
+		// buffer and the checksum's part block are a fixed cost on top, they come out of the budget before it's split.
+		std::ifstream newStream(newFilePath, std::ios::in | std::ios::binary);
+
+		if (!useMapping || !oldFile.openMapped(oldFilePath) || !newStream.is_open())
+			return false;
+
+		oldFile.advise(accessPattern::random);
+
+		const char* oldData = oldFile.data();
+		const size_t oldSize = oldFile.size();
+		const size_t splitBudget = memoryBudget > streamingBuffers() ? memoryBudget - streamingBuffers() : 0;
+		const size_t indexBudget = std::max<size_t>(splitBudget / 2, STREAMINDEXENTRY);
+		const size_t blockSize = std::max<size_t>(ROLLINGHASHBLOCK, (oldSize / (indexBudget / STREAMINDEXENTRY)) + 1);
+		const size_t windowSize = std::max<size_t>(splitBudget / 2, blockSize * 4);
+		const uint64_t base = 0x100000001B3ull; // Same hash as findCommonRangesRollingHash.
+		uint64_t outgoingFactor = 1;
+		std::vector<std::pair<uint64_t, uint64_t>> blockIndex;
+
+		for (size_t i = 1; i < blockSize; i++)
+			outgoingFactor *= base;
+
+		auto hashBlock = [&](const char* block) -> uint64_t
+		{
+			uint64_t hash = 0;
+			for (size_t i = 0; i < blockSize; i++)
+				hash = hash * base + (unsigned char)block[i];
+			return hash;
+		};
+
+		blockIndex.reserve(oldSize / blockSize);
+		for (size_t offset = 0; offset + blockSize <= oldSize; offset += blockSize)
+			blockIndex.push_back({ hashBlock(&oldData[offset]), offset });
+		std::sort(blockIndex.begin(), blockIndex.end());
+
+		report = { 0, 0, 0, 0, 0 };
+		report.oldFileSize = oldSize;
+
+		// The new file's size and checksum aren't known until it's all been through, the binary header gets them
+		// filled in at the end.
+		patchHeader header = { oldFilePath, newFilePath, oldSize, 0, 0, 0, format == patchFormat::binary };
+		patchChecksum newChecksum;
+		patchWriter patch(afileStream, format);
+
+		if (header.hasChecksums)
+			header.oldChecksum = checksumBuffer(oldData, oldSize);
+		patch.writeHeader(header);
+
+		std::vector<char> window(windowSize);
+		size_t filled = 0;			// Bytes of the new file in the window.
+		size_t position = 0;		// Where in the window the next match could start.
+		size_t insertStart = 0;		// Start of new bytes not yet written out, always at or before position.
+		size_t oldCursor = 0;		// Everything in the old file before here has been copied or deleted.
+		size_t windowStart = 0;		// Offset in the new file of the start of the window.
+		size_t newCursor = 0;		// Offset in the new file just past the last match.
+		bool endOfFile = false;
+		bool matchAtEdge = false;	// The last match ran into the end of the window, it may carry on in the next one.
+
+		auto writeInsert = [&](size_t end)
+		{
+			if (end > insertStart)
+			{
+				patch.insertBytes(&window[insertStart], end - insertStart);
+				report.insertedCharacters += end - insertStart;
+			}
+			insertStart = end;
+		};
+
+		auto writeCopy = [&](size_t oldStart, size_t length)
+		{
+			if (oldStart > oldCursor)
+			{
+				patch.deleteBytes(oldStart - oldCursor);
+				report.deletedCharacters += oldStart - oldCursor;
+			}
+			patch.copyBytes(length);
+			report.sameCharacters += length;
+			oldCursor = oldStart + length;
+		};
 
-		for (int j = rangeStart; j < rangeEnd; j++)
+		while (true)
 		{
-			for (int x = 0; x < newFileBufferArray[i].pointerBuffer.size(); x++)
+			// Finalise everything before position and slide what's left to the front, then top the window back up.
+			writeInsert(position);
+			windowStart += position;
+			memmove(window.data(), &window[position], filled - position);
+			filled -= position;
+			insertStart = position = 0;
+
+			while (!endOfFile && filled < windowSize)
+			{
+				newStream.read(&window[filled], windowSize - filled);
+				if (header.hasChecksums)
+					newChecksum.update(&window[filled], (size_t)newStream.gcount());
+				filled += (size_t)newStream.gcount();
+				report.newFileSize += (size_t)newStream.gcount();
+				endOfFile = !newStream;
+			}
+
+			// A match cut off by the end of the last window picks up where it left off.
+			if (matchAtEdge)
 			{
-				char* oleft, * oright;
-				char* nleft, * nright;
-				int range = 1;
+				size_t length = matchForward(&oldData[oldCursor], window.data(), std::min(oldSize - oldCursor, filled));
 
-				if (threadPercent[athread] == 150)
+				matchAtEdge = false;
+				if (length >= minimumMatch)
 				{
-					int orangeEnd = rangeEnd;
-					threadRequest* request = threadDistributer();
-					// We just got the signal to split in half.
-						
-					if (request != nullptr)
-					{	// Only continue if we secured a thread for sure.
-						std::thread *workthread;
-						// Manually adjust our new rangeStart and rangeEnd
-						rangeStart = j;
-						rangeEnd = (rangeEnd - rangeStart) / 2 + rangeStart;
-
-						// break a new thread off that will handle the other half of the range.
-						threadActive[request->threadId] = true;
-						workthread = new std::thread(&dashDiff::findCommonRanges, this, i, request->threadId, rangeEnd, orangeEnd);
-						workthread->detach(); // Memory leak, but minor. Find a way to feed this information backwards to the main thread.
-						delete request;
-					}
+					writeCopy(oldCursor, length);
+					insertStart = position = length;
+					newCursor = windowStart + length;
+					matchAtEdge = length == filled && !endOfFile;
 				}
+			}
 
-				threadPercent[athread] = (int)((float)((j - rangeStart) * newFileBufferArray[i].pointerBuffer.size() + x) / (float)((rangeEnd - rangeStart) * newFileBufferArray[i].pointerBuffer.size()) * 100);
+			uint64_t hash = position + blockSize <= filled ? hashBlock(&window[position]) : 0;
+			streamMatch pending = { 0, 0, 0 };	// A match that jumps well ahead in the old file, held back while we look for a nearer one.
+			size_t pendingBlock = 0;			// Where in the window its block hit was.
+			size_t pendingUntil = 0;
 
-				oleft = oright = oldFileBufferArray[i].pointerBuffer[j].reference;
-				nleft = nright = newFileBufferArray[i].pointerBuffer[x].reference;
-				// Expand to the left as much as we can while each character matches
-				while (true)
-				{
-					if (oleft == oldFileBufferArray[i].pointerBuffer[j].min || nleft == newFileBufferArray[i].pointerBuffer[x].min)
-						break;
+			auto takeMatch = [&](const streamMatch& match)
+			{
+				writeInsert(match.newStart);
+				writeCopy(match.oldStart, match.length);
+				insertStart = position = match.newStart + match.length;
+				newCursor = windowStart + position;
+				matchAtEdge = position == filled && !endOfFile;
+				pending.length = 0;
+
+				if (position + blockSize <= filled)
+					hash = hashBlock(&window[position]);
+			};
+
+			// How much further a match moves through the old file than through the new one since the last match. Zero on
+			// the cursor's own diagonal, where the bytes between are edits on both sides.
+			auto jumpLength = [&](const streamMatch& match) -> size_t
+			{
+				size_t oldSkip = match.oldStart - oldCursor, newSkip = windowStart + match.newStart - newCursor;
 
-					if (*(--oleft) != *(--nleft))
-						break;
+				return oldSkip > newSkip ? oldSkip - newSkip : 0;
+			};
 
-					range++;
-				}
+			// Everything between the cursor and a match is deleted, and greedy means it's gone for good. A jump is only
+			// worth that if it's within STREAMJUMPRATIO times the match length, or the match is long enough that it's
+			// clearly where the new file went and not a stray repeat. One that ran into the end of what we could see may
+			// be longer still.
+			auto worthJump = [&](const streamMatch& match)
+			{
+				return match.length * STREAMJUMPRATIO >= jumpLength(match) || match.length >= blockSize * STREAMJUMPBLOCKS ||
+					match.newStart + match.length == filled || match.oldStart + match.length == oldSize;
+			};
+
+			// Last chance before a jump is taken. Only whole blocks are indexed, so the same bytes can sit just past the
+			// cursor without a block boundary lining up with them, or the last match may have run a little past where the
+			// cursor's diagonal picks up again. Search a little of the old file there for the next few blocks of the new
+			// one, and take that instead if it's there.
+			auto settlePending = [&]()
+			{
+				const size_t jumpReach = blockSize * STREAMJUMPBLOCKS;
+				size_t probe = position + blockSize <= filled ? position : pendingBlock;
+				size_t probeEnd = std::min(filled, probe + jumpReach);
 
-				// Now expand to the right as much as we can.
-				while (true)
+				for (; probe + blockSize <= probeEnd; probe += blockSize)
 				{
-					if (oright == oldFileBufferArray[i].pointerBuffer[j].max || nright == newFileBufferArray[i].pointerBuffer[x].max)
-						break;
+					size_t newSkip = windowStart + probe - newCursor;
+					size_t searchEnd = std::min<size_t>(pending.oldStart, oldCursor + jumpReach + std::min(newSkip, jumpReach) + blockSize);
 
-					if (*(++oright) != *(++nright))
+					if (searchEnd < oldCursor + blockSize)
 						break;
 
-					range++;
-				}
+					const char* found = std::search(&oldData[oldCursor], &oldData[searchEnd],
+						std::boyer_moore_horspool_searcher<const char*>(&window[probe], &window[probe] + blockSize));
 
-				dualRange tempRange;
-				bool itSafe = true;
-
-				tempRange.oldRange.start = oleft++;
-				tempRange.oldRange.end = oright;
-				tempRange.oldRange.min = oldFileBufferArray[i].pointerBuffer[j].min;
-				tempRange.oldRange.max = oldFileBufferArray[i].pointerBuffer[j].max;
-				tempRange.oldRange.reference = oldFileBufferArray[i].pointerBuffer[j].reference;
-				tempRange.newRange.start = nleft++;
-				tempRange.newRange.end = nright;
-				tempRange.newRange.min = newFileBufferArray[i].pointerBuffer[x].min;
-				tempRange.newRange.max = newFileBufferArray[i].pointerBuffer[x].max;
-				tempRange.newRange.reference = newFileBufferArray[i].pointerBuffer[x].reference;
-
-				for (int rangeTest = 0; rangeTest < localRangeVector.size(); rangeTest++)
-				{
-					if (valuesOverlap(tempRange.oldRange, localRangeVector[rangeTest].oldRange) ||
-						valuesOverlap(tempRange.newRange, localRangeVector[rangeTest].newRange))
+					if (found != &oldData[searchEnd])
 					{
-						itSafe = false;
-						break;
+						size_t nearBlock = found - oldData;
+						size_t back = matchBackward(found, &window[probe], std::min<size_t>(nearBlock - oldCursor, probe - insertStart));
+						size_t forward = matchForward(found, &window[probe], std::min<size_t>(oldSize - nearBlock, filled - probe));
+
+						takeMatch({ probe - back, nearBlock - back, back + forward });
+						return true;
 					}
 				}
 
-				if (range > 4 && itSafe) // Set to a 5 minimum because the code for S[text] is 4 bytes long as a minimum.
-				{				// So while we can skip that text, it really doesm't save us anything and just increases
-								// the size of the patch file, and computation time.
-					dualRange response;
-
-
-					// Alright old man, you sped, and now it's time to pay the man. Let me fill you out a ticket.
-					response.rangeSize = range;
-					response.oldRange.end = oright;
-					response.oldRange.start = oleft;
-					response.newRange.end = nright;
-					response.newRange.start = nleft;
-					response.newRange.max = newFileBufferArray[i].pointerBuffer[x].max;
-					response.newRange.min = newFileBufferArray[i].pointerBuffer[x].min;
-					response.newRange.reference = newFileBufferArray[i].pointerBuffer[x].reference;
-
-					localRangeVector.push_back(response);
-
+				if (worthJump(pending))
+				{
+					takeMatch(pending);
+					return true;
 				}
-			}
-		}
-
-		if (localRangeVector.size() > 0)
-		{
-			rangeVectorMutex.lock();
 
-			rangeVector.insert(rangeVector.end(), localRangeVector.begin(), localRangeVector.end());
+				pending.length = 0;
+				return false;
+			};
 
-			removeWeakOverlaps();
-			reduceOverlaps();
-
-			rangeVectorMutex.unlock();
-		}
-
-		threadActive[athread] = false; // Feels wrong, but here we are.
-	}
+			while (position + blockSize <= filled)
+			{
+				auto hits = std::equal_range(blockIndex.begin(), blockIndex.end(), std::make_pair(hash, (uint64_t)0),
+					[](const std::pair<uint64_t, uint64_t>& a, const std::pair<uint64_t, uint64_t>& b) { return a.first < b.first; });
+				streamMatch bestNear = { 0, 0, 0 }, bestFar = { 0, 0, 0 };
+				int tested = 0;
 
-	void dashDiff::progressToConsole(std::chrono::time_point<std::chrono::system_clock> startOperations)
-	{
-		for (int x = 0; x < THREADCOUNT; x++)
-		{
-			if (threadActive[x])
-				std::cout << "[" << std::setw(3) << threadPercent[x] << "%]";
-			else
-				std::cout << "[___%]";
-		}
+				for (auto hit = hits.first; hit != hits.second && tested < ROLLINGHASHCANDIDATES; hit++)
+				{
+					if (hit->second < oldCursor)
+						continue; // Behind the last match, the patch can't go back for it.
+					tested++;
 
-		{
-			const std::chrono::time_point<std::chrono::system_clock> currentOperations = std::chrono::system_clock::now();
-			std::cout << "  Elapsed Time: " << std::chrono::duration_cast<std::chrono::seconds>(currentOperations - startOperations).count();
+					if (memcmp(&oldData[hit->second], &window[position], blockSize) != 0)
+						continue; // Hash collision.
 
+					// Grow it both ways, back over new bytes still waiting to go out and old bytes not yet used.
+					size_t back = matchBackward(&oldData[hit->second], &window[position], std::min<size_t>(hit->second - oldCursor, position - insertStart));
+					size_t forward = matchForward(&oldData[hit->second], &window[position], std::min<size_t>(oldSize - hit->second, filled - position));
+					streamMatch match = { position - back, hit->second - back, back + forward };
 
-			rangeVectorMutex.lock();
-			int entriespersecond = 0;
+					// Near means it jumps no further than it matches, the cursor's own diagonal or close to it.
+					streamMatch& best = jumpLength(match) <= std::max(match.length, blockSize) ? bestNear : bestFar;
 
-			if (std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - startOperations).count() > 0)
-				entriespersecond = rangeVector.size() / std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - startOperations).count();
-			rangeVectorMutex.unlock();
+					if (match.length > best.length)
+						best = match;
+				}
 
-			std::cout << " second(s) {" << entriespersecond << " matches per second}\r";
+				if (bestNear.length > 0)
+				{
+					takeMatch(bestNear);
+					continue;
+				}
 
-		}
-	}
+				// A jump waits a block, a nearer match on the cursor's diagonal shows up within that if there is one.
+				if (bestFar.length > pending.length)
+				{
+					if (pending.length == 0)
+						pendingUntil = position + blockSize;
+					pending = bestFar;
+					pendingBlock = position;
+				}
+				if (pending.length > 0 && position >= pendingUntil && settlePending())
+					continue;
 
-	void dashDiff::dumpBuffersintoArray(void)
-	{
-		int threadId[THREADCOUNT];
-		const std::chrono::time_point<std::chrono::system_clock> startOperations = std::chrono::system_clock::now();
+				// Roll the window forward one byte.
+				if (position + blockSize < filled)
+					hash = (hash - (unsigned char)window[position] * outgoingFactor) * base + (unsigned char)window[position + blockSize];
+				position++;
+			}
 
-		memset(threadId, 0, sizeof(threadId));
+			// The window ran out during a lookahead, settle the held match before it slides away.
+			if (pending.length > 0)
+				settlePending();
 
-		// Dump the buffers into the arrays for sorting.
-		for (int i = 0; i < oldFileBufferSize; i++)
-		{	// 128 + because char's are unsigned by default. I only missed this because I was using plaintext before.
-			oldFileBufferArray[128 + oldFileBuffer[i]].add(&oldFileBuffer[i], &oldFileBuffer[i], &oldFileBuffer[i], &oldFileBuffer[0], &oldFileBuffer[oldFileBufferSize - 1]);
+			if (endOfFile)
+				break;
 		}
 
-		for (int i = 0; i < newFileBufferSize; i++)
+		// Same order writeToPatchFile finishes in, the rest of the old file goes, then the rest of the new one arrives.
+		if (oldCursor < oldSize)
 		{
-			newFileBufferArray[128 + newFileBuffer[i]].add(&newFileBuffer[i], &newFileBuffer[i], &newFileBuffer[i], &newFileBuffer[0], &newFileBuffer[newFileBufferSize - 1]);
+			patch.deleteBytes(oldSize - oldCursor);
+			report.deletedCharacters += oldSize - oldCursor;
 		}
+		writeInsert(filled);
+		patch.finish();
 
-		std::thread* workthread[THREADCOUNT];
-
-		for (int i = 0; i < THREADCOUNT; i++)
-			workthread[i] = nullptr;
-
-		for (int i = 0; i < 256; i++)
-		{
-			if (oldFileBufferArray[i].pointerBuffer.size() == 0 || newFileBufferArray[i].pointerBuffer.size() == 0)
-				continue; // Skip this character if it doesn't exist in both files, it can't be valid.
-
-			// Check to see if any threads are joinable, if so make them null.
-			while (true)
-			{
-				bool nullExists = false;
-				for (int x = 0; x < THREADCOUNT; x++)
-				{
-					if (workthread[x] != nullptr)
-					{
-						if (!threadActive[x])
-						{
-							delete workthread[x];
-							workthread[x] = nullptr;
-
-							nullExists = true;
-						}
-					}
-					else
-						nullExists = true;
-				}
-
-				progressToConsole(startOperations);
-
-				std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-				if (nullExists)
-					break;
-			}
-			// Check to see if any threads are null, if so, make them work.
+		header.newSize = report.newFileSize;
+		header.newChecksum = newChecksum.value();
+		patch.rewriteHeader(header);
 
-			threadRequest *request = threadDistributer();
-
-			if (request != nullptr)
-			{
-				workthread[request->threadId] = new std::thread(&dashDiff::findCommonRanges, this, i, request->threadId, 0, oldFileBufferArray[i].pointerBuffer.size());
-				threadId[request->threadId] = i;
-				workthread[request->threadId]->detach();
+		return true;
+	}
 
-				delete request;
-				continue;
-			}
+	applyResult dashDiff::applyOps(patchReader reader, patchCheckpoint& at, uint64_t patchEnd, char* outputData, uint64_t newSize, differencesReport& counts)
+	{
+		// Every op is a single memcpy: S straight out of the old file, + straight out of the patch.
+		const char* oldData = oldFile.data();
+		const uint64_t oldSize = oldFile.size();
+		patchOp op;
 
-		}
+		// The index isn't covered by the checksums, so a piece can't be trusted to start inside the files.
+		if (at.newOffset > newSize || at.oldOffset > oldSize)
+			return applyResult::damaged;
 
-		// Wait for all threads to finish
-		while (true)
+		reader.seek(at.patchOffset);
+		while (reader.tell() < patchEnd && reader.next(op))
 		{
-			int lowestThread = -1;
-			int lowestPercent = 100;
-
-			if (!threadsActive())
-				break;
-
-			// If we still have a thread active, find the lowest one and give it the command to break in two.
-			for (int i = 0; i < THREADCOUNT; i++)
+			if (op.type == '+')
 			{
-				if (threadActive[i])
-				{
-					if (threadPercent[i] < lowestPercent)
-					{
-						lowestPercent = threadPercent[i];
-						lowestThread = i;
-					}
-
-				}
+				if (op.length > newSize - at.newOffset)
+					return applyResult::wrongSize;
+				memcpy(&outputData[at.newOffset], op.payload, (size_t)op.length);
+				at.newOffset += op.length;
+				counts.insertedCharacters += op.length;
+				continue;
 			}
 
-			progressToConsole(startOperations);
+			if (op.length > oldSize - at.oldOffset)
+				return applyResult::damaged;
 
-			if (lowestThread != -1)
+			if (op.type == 'S')
 			{
-				threadPercent[lowestThread] = 150; // This is a signal to the thread to break in two.
+				if (op.length > newSize - at.newOffset)
+					return applyResult::wrongSize;
+				memcpy(&outputData[at.newOffset], &oldData[at.oldOffset], (size_t)op.length);
+				at.newOffset += op.length;
+				counts.sameCharacters += op.length;
 			}
-			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			else
+				counts.deletedCharacters += op.length;
+			at.oldOffset += op.length;
 		}
 
-		progressToConsole(startOperations);
-	}
-
-	void dashDiff::sortRanges(void)
-	{
-		// Sort the ranges by the start of the old range.
-		std::sort(rangeVector.begin(), rangeVector.end());
+		at.patchOffset = reader.tell();
+		return reader.failed() ? applyResult::damaged : applyResult::applied;
 	}
 
-	void dashDiff::readIntoBuffers(void)
+	applyResult dashDiff::applyPatchFile(const char* patchPath, const char* oldPath, const char* outputPath)
 	{
-		// Check if the files are open.
-		if (!oldFile.is_open() || !newFile.is_open())
-		{
-			std::cout << "dashDiff::dashDiff.readIntoBuffers(): Files are not open for reading." << std::endl;
-			exit(-1);
-		}
+		// Both inputs are mapped and the output is created at its final size and mapped too, so the ops copy straight
+		// from one to the other with nothing staged in between. Binary patches carry an index of where every few thousand
+		// ops start in all three, so the pieces between checkpoints go to the pool and are applied at the same time.
+		mappedFile patchFile;
+		mappedOutput output;
+		patchReader reader;
+		patchHeader header;
+		patchOp op;
+		std::vector<patchCheckpoint> checkpoints;
 
-		// Get the size of the files.
-		oldFile.seekg(0, std::ios::end);
-		oldFileBufferSize = oldFile.tellg();
-		oldFile.seekg(0, std::ios::beg);
-
-		newFile.seekg(0, std::ios::end);
-		newFileBufferSize = newFile.tellg();
-		newFile.seekg(0, std::ios::beg);
+		report = { 0, 0, 0, 0, 0 };
 
-		// Allocate the buffers.
-		oldFileBuffer = new char[oldFileBufferSize];
-		newFileBuffer = new char[newFileBufferSize];
+		if (!patchFile.open(patchPath, useMapping) || !oldFile.open(oldPath, useMapping))
+			return applyResult::unreadable;
+		if (!reader.open(patchFile.data(), patchFile.size(), header))
+			return applyResult::damaged;
 
-		// Read the files into the buffers.
-		oldFile.read(oldFileBuffer, oldFileBufferSize);
-		newFile.read(newFileBuffer, newFileBufferSize);
+		const uint64_t oldSize = oldFile.size();
+		uint64_t newSize = header.newSize;
 
-		// Captain, Captain, ready to rip.
-	}
+		// Check it's the right base before anything is written.
+		if (header.hasChecksums && (header.oldSize != oldSize || header.oldChecksum != checksumBuffer(oldFile.data(), oldSize)))
+			return applyResult::wrongOldFile;
 
-	bool dashDiff::openForComparison(const char* oldFilePath, const char* newFilePath)
-	{
-		report = { 0, 0, 0, 0, 0 };
+		// Text patches don't say how big the result is. A pass over just the tokens adds it up, the payloads are stepped
+		// over. It has to use up exactly the old file too, nothing is created for a patch that can't apply.
+		if (reader.getFormat() == patchFormat::text)
+		{
+			patchReader sizing = reader;
+			uint64_t oldUsed = 0;
 
-		// open both files as binary input streams.
-		oldFile.open(oldFilePath, std::ios::in | std::ios::binary);
-		newFile.open(newFilePath, std::ios::in | std::ios::binary);
+			for (newSize = 0; sizing.next(op);)
+			{
+				if (op.type != '+' && op.length > oldSize - oldUsed)
+					return applyResult::damaged;
+				oldUsed += op.type != '+' ? op.length : 0;
+				newSize += op.type != '-' ? op.length : 0;
+			}
+			if (sizing.failed())
+				return applyResult::damaged;
+			if (oldUsed != oldSize)
+				return applyResult::wrongOldFile;
+		}
 
-		// If either file failed to open, return false.
-		if (!oldFile.is_open() || !newFile.is_open())
+		// The index has to start where the ops do, only move forward and stay inside all three files, otherwise it's no
+		// use. Nothing checksums it, so it's checked here. Without one the whole patch is a single piece.
+		reader.readIndex(checkpoints);
+		for (size_t i = 0; i < checkpoints.size(); i++)
 		{
-			return false;
+			const patchCheckpoint& previous = i > 0 ? checkpoints[i - 1] : patchCheckpoint{ reader.tell(), 0, 0 };
+
+			if (i == 0 ? checkpoints[i].patchOffset != previous.patchOffset || checkpoints[i].newOffset != 0 || checkpoints[i].oldOffset != 0 :
+				checkpoints[i].patchOffset <= previous.patchOffset || checkpoints[i].newOffset < previous.newOffset || checkpoints[i].oldOffset < previous.oldOffset)
+				return applyResult::damaged;
+			if (checkpoints[i].patchOffset >= reader.end() || checkpoints[i].newOffset > newSize || checkpoints[i].oldOffset > oldSize)
+				return applyResult::damaged;
 		}
+		if (checkpoints.empty())
+			checkpoints.push_back({ reader.tell(), 0, 0 });
 
-		return true;
-	}
+		if (newSize > (size_t)-1 || !output.create(outputPath, (size_t)newSize))
+			return applyResult::unwritable;
 
-	void dashDiff::writeToPatchFile(std::fstream* afileStream)
-	{
-		char* oldFilePointer = oldFileBuffer;
-		char* newFilePointer = newFileBuffer;
+		// Each piece runs front to back through all three files.
+		oldFile.advise(accessPattern::sequential);
+		patchFile.advise(accessPattern::sequential);
 
-		report.oldFileSize = oldFileBufferSize;
-		report.newFileSize = newFileBufferSize;
+		// Group checkpoints into pieces of about the same amount of output, a few per worker so there's something to steal.
+		const uint64_t pieceSize = std::max<uint64_t>(APPLYPIECEMINIMUM, newSize / (workers().size() * APPLYPIECESPERWORKER));
+		std::vector<size_t> pieceStart;
 
-		for (int i = 0; i < rangeVector.size(); i++)
+		for (size_t i = 0; i < checkpoints.size(); i++)
 		{
-			// Delete everything in the old file before the range.
-			if (oldFilePointer != rangeVector[i].oldRange.start)
-			{
-				*afileStream << "-[" << rangeVector[i].oldRange.start - oldFilePointer << "]";
-				report.deletedCharacters += rangeVector[i].oldRange.start - oldFilePointer;
-				oldFilePointer = rangeVector[i].oldRange.start;
-			}
-			// Add everything in the new file before the range.
-			if (newFilePointer != rangeVector[i].newRange.start)
-			{
-				*afileStream << "+[" << rangeVector[i].newRange.start - newFilePointer << "]";
-				while (newFilePointer < rangeVector[i].newRange.start)
-				{
-					*afileStream << *newFilePointer;
-					newFilePointer++;
-					report.insertedCharacters++;
-				};
-			}
-			// Skip the range
-			*afileStream << "S[" << rangeVector[i].oldRange.end - rangeVector[i].oldRange.start << "]";
-			oldFilePointer = rangeVector[i].oldRange.end;
-			newFilePointer = rangeVector[i].newRange.end;
-			report.sameCharacters += rangeVector[i].oldRange.end - rangeVector[i].oldRange.start;
+			if (pieceStart.empty() || checkpoints[i].newOffset - checkpoints[pieceStart.back()].newOffset >= pieceSize)
+				pieceStart.push_back(i);
 		}
-		// Print the rest of the old file.
-		if (oldFilePointer != &oldFileBuffer[oldFileBufferSize])
+
+		std::vector<patchCheckpoint> pieceEnd(pieceStart.size());
+		std::vector<applyResult> pieceResult(pieceStart.size());
+		std::vector<differencesReport> pieceCounts(pieceStart.size(), differencesReport{ 0, 0, 0, 0, 0 });
+		char* outputData = output.data();
+
+		for (size_t piece = 0; piece < pieceStart.size(); piece++)
 		{
-			*afileStream << "-[" << &oldFileBuffer[oldFileBufferSize] - oldFilePointer << "]";
-			report.deletedCharacters += &oldFileBuffer[oldFileBufferSize] - oldFilePointer;
+			workers().submit([&, piece]()
+			{
+				// The last piece runs to the end op, the others stop at the next piece's first checkpoint.
+				uint64_t patchEnd = piece + 1 < pieceStart.size() ? checkpoints[pieceStart[piece + 1]].patchOffset : UINT64_MAX;
+
+				pieceEnd[piece] = checkpoints[pieceStart[piece]];
+				pieceResult[piece] = applyOps(reader, pieceEnd[piece], patchEnd, outputData, newSize, pieceCounts[piece]);
+			});
 		}
-		// Print the rest of the new file.
-		if (newFilePointer != &newFileBuffer[newFileBufferSize])
+		workers().wait();
+
+		// Every piece has to finish exactly where the index says the next one starts, and the last at the ends of both files.
+		for (size_t piece = 0; piece < pieceStart.size(); piece++)
 		{
-			*afileStream << "+[" << &newFileBuffer[newFileBufferSize] - newFilePointer << "]";
-			while (newFilePointer != &newFileBuffer[newFileBufferSize])
-			{
-				*afileStream << *newFilePointer;
-				newFilePointer++;
-				report.insertedCharacters++;
-			}
+			const patchCheckpoint expected = piece + 1 < pieceStart.size() ? checkpoints[pieceStart[piece + 1]] : patchCheckpoint{ pieceEnd[piece].patchOffset, newSize, oldSize };
+
+			if (pieceResult[piece] != applyResult::applied)
+				return pieceResult[piece];
+			if (pieceEnd[piece].patchOffset != expected.patchOffset)
+				return applyResult::damaged;
+			if (pieceEnd[piece].newOffset != expected.newOffset)
+				return piece + 1 < pieceStart.size() ? applyResult::damaged : applyResult::wrongSize;
+			// Every patch we write accounts for the whole old file, one that stops short was made against a shorter one.
+			if (pieceEnd[piece].oldOffset != expected.oldOffset)
+				return piece + 1 < pieceStart.size() ? applyResult::damaged : applyResult::wrongOldFile;
+
+			report.deletedCharacters += pieceCounts[piece].deletedCharacters;
+			report.insertedCharacters += pieceCounts[piece].insertedCharacters;
+			report.sameCharacters += pieceCounts[piece].sameCharacters;
 		}
+
+		if (header.hasChecksums && checksumBuffer(outputData, (size_t)newSize) != header.newChecksum)
+			return applyResult::wrongChecksum;
+		if (!output.commit())
+			return applyResult::unwritable;
+
+		report.oldFileSize = oldSize;
+		report.newFileSize = newSize;
+		return applyResult::applied;
 	}
 
 	void dashDiff::displayDifferences(void)
 	{
-		char* oldFilePointer = oldFileBuffer;
-		char* newFilePointer = newFileBuffer;
+		const char* oldFilePointer = oldFileBuffer;
+		const char* newFilePointer = newFileBuffer;
 
 		for (int i = 0; i < rangeVector.size(); i++)
 		{
@@ -585,29 +1975,79 @@ namespace dashDiff
 		oldFileBuffer = nullptr;
 		newFileBuffer = nullptr;
 		oldFileBufferSize = newFileBufferSize = 0;
-			
-		for (int i = 0; i < THREADCOUNT; i++)
-		{
-			threadActive[i] = false;
-			threadPercent[i] = 0;
-		}
+		engine = matchEngine::byteBuckets;
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+		matchCount = 0;
+		useMapping = true;
+		memoryBudget = 0;
+		setPatchFormat(patchFormat::text);
 	}
 
 	dashDiff::~dashDiff()
 	{
-		// If the files are open, close them.
-		if (oldFile.is_open())
-		{
-			oldFile.close();
-		}
-		if (newFile.is_open())
-		{
-			newFile.close();
-		}
-			
-		free( oldFileBuffer);
-		free( newFileBuffer);
+		// The workers might still be holding pointers into the files, stop them before the files go.
+		pool.reset();
+
+		oldFile.close();
+		newFile.close();
+	}
+}
+
+static void printReport(dashDiff::differencesReport report)
+{
+	std::cout << std::endl << "Differences Report:" << std::endl;
+	std::cout << "Old File Size: " << report.oldFileSize << std::endl;
+	std::cout << "New File Size: " << report.newFileSize << std::endl;
+	std::cout << "Characters Deleted: " << report.deletedCharacters << std::endl;
+	std::cout << "Characters Deleted (Percentage of old Document):" << (float)report.deletedCharacters / (float)report.oldFileSize * 100.0f << "%" << std::endl;
+	std::cout << "Characters Inserted: " << report.insertedCharacters << std::endl;
+	std::cout << "Characters Inserted (Percentage of new Document):" << (float)report.insertedCharacters / (float)report.newFileSize * 100.0f << "%" << std::endl;
+	std::cout << "Characters Same: " << report.sameCharacters << std::endl;
+	std::cout << "Characters Same (Percentage of old Document):" << (float)report.sameCharacters / (float)report.oldFileSize * 100.0f << "%" << std::endl;
+}
+
+// Apply mode, FileList holds the patch, the old file and where the new file goes.
+static int applyPatch(dashDiff::dashDiff& dashDiff, std::vector<std::string>& FileList)
+{
+	if (FileList.size() != 3)
+	{
+		std::cout << "dashDiff::main(): --apply expects a patch file, the old file and an output file." << std::endl;
+		return -1;
+	}
+
+	std::cout << "Applying " << FileList[0] << " to " << FileList[1] << std::endl;
+
+	auto startApply = std::chrono::steady_clock::now();
+	dashDiff::applyResult result = dashDiff.applyPatchFile(FileList[0].c_str(), FileList[1].c_str(), FileList[2].c_str());
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startApply);
+
+	switch (result)
+	{
+	case dashDiff::applyResult::applied:
+		break;
+	case dashDiff::applyResult::unreadable:
+		std::cout << "dashDiff::main(): Failed to open the patch or the old file." << std::endl;
+		return -1;
+	case dashDiff::applyResult::unwritable:
+		std::cout << "dashDiff::main(): Failed to write " << FileList[2] << "." << std::endl;
+		return -1;
+	case dashDiff::applyResult::damaged:
+		std::cout << "dashDiff::main(): " << FileList[0] << " is damaged or doesn't fit the old file." << std::endl;
+		return -1;
+	case dashDiff::applyResult::wrongOldFile:
+		std::cout << "dashDiff::main(): " << FileList[1] << " isn't the file the patch was made against." << std::endl;
+		return -1;
+	case dashDiff::applyResult::wrongSize:
+		std::cout << "dashDiff::main(): The patch doesn't produce the file size its header gives." << std::endl;
+		return -1;
+	case dashDiff::applyResult::wrongChecksum:
+		std::cout << "dashDiff::main(): The result doesn't match the checksum in the patch." << std::endl;
+		return -1;
 	}
+
+	std::cout << "Wrote " << FileList[2] << " in " << elapsed.count() << "ms." << std::endl;
+	printReport(dashDiff.getReport());
+	return 0;
 }
 
 int main(int argc, char** argv)
@@ -615,6 +2055,8 @@ int main(int argc, char** argv)
 	std::vector<std::string> FileList;
 	std::string patchFile = "patch.dph";
 	std::fstream patchFileStream;
+	bool applyMode = false;
+	long long memoryMegabytes = 0;
 
 	dashDiff::dashDiff dashDiff;
 
@@ -622,13 +2064,103 @@ int main(int argc, char** argv)
 	std::cout << "All rights reserved. If it went kapoop, I didn't do it. That code was written by a guy named Bob." << std::endl;
 	std::cout << "We must all try to hurt Bob whenever he exposes himself from between the cushions of the code." << std::endl;
 	std::cout << "=-----------------------------------------------------------------------------------------------=" << std::endl;
+	std::cout << "Match extension kernels: " << dashDiff::matchKernelName() << std::endl;
 	
 	// Let's look for our arguments.
 	for (int i = 1; i < argc; i++)
 	{
+		std::string argument = argv[i];
+
+		if (argument.rfind("--engine=", 0) == 0)
+		{
+			std::string engineName = argument.substr(9);
+
+			if (engineName == "bytebuckets")
+				dashDiff.setMatchEngine(dashDiff::matchEngine::byteBuckets);
+			else if (engineName == "suffixarray")
+				dashDiff.setMatchEngine(dashDiff::matchEngine::suffixArray);
+			else if (engineName == "rollinghash")
+				dashDiff.setMatchEngine(dashDiff::matchEngine::rollingHash);
+			else if (engineName == "myers")
+				dashDiff.setMatchEngine(dashDiff::matchEngine::myersLines);
+			else if (engineName == "histogram")
+				dashDiff.setMatchEngine(dashDiff::matchEngine::histogramLines);
+			else
+			{
+				std::cout << "dashDiff::main(): Unknown engine " << engineName << ", expected bytebuckets, suffixarray, rollinghash, myers or histogram." << std::endl;
+				return -1;
+			}
+			continue;
+		}
+
+		if (argument.rfind("--memory=", 0) == 0)
+		{
+			memoryMegabytes = atoll(argument.substr(9).c_str());
+
+			if (memoryMegabytes < 1)
+			{
+				std::cout << "dashDiff::main(): Invalid memory budget " << argument.substr(9) << ", expected a number of megabytes above 0." << std::endl;
+				return -1;
+			}
+			dashDiff.setMemoryBudget((size_t)memoryMegabytes << 20);
+			continue;
+		}
+
+		if (argument.rfind("--format=", 0) == 0)
+		{
+			std::string formatName = argument.substr(9);
+
+			if (formatName == "text")
+				dashDiff.setPatchFormat(dashDiff::patchFormat::text);
+			else if (formatName == "binary")
+				dashDiff.setPatchFormat(dashDiff::patchFormat::binary);
+			else
+			{
+				std::cout << "dashDiff::main(): Unknown patch format " << formatName << ", expected text or binary." << std::endl;
+				return -1;
+			}
+			continue;
+		}
+
+		if (argument == "--apply")
+		{
+			applyMode = true;
+			continue;
+		}
+
+		if (argument == "--no-mmap")
+		{
+			dashDiff.setMemoryMapping(false);
+			continue;
+		}
+
+		if (argument.rfind("--threads=", 0) == 0)
+		{
+			int threads = atoi(argument.substr(10).c_str());
+
+			if (threads < 1)
+			{
+				std::cout << "dashDiff::main(): Invalid thread count " << argument.substr(10) << ", expected a number above 0." << std::endl;
+				return -1;
+			}
+			dashDiff.setThreadCount(threads);
+			continue;
+		}
+
 		FileList.push_back(argv[i]);
 	}
 
+	if (applyMode)
+		return applyPatch(dashDiff, FileList);
+
+	// The budget has to leave something for the index and window once the fixed buffers are paid for.
+	if (dashDiff.isStreaming() && memoryMegabytes <= (long long)(dashDiff.streamingBuffers() >> 20))
+	{
+		std::cout << "dashDiff::main(): A memory budget of " << memoryMegabytes << "MB doesn't leave room to stream in, the patch buffers take "
+			<< (dashDiff.streamingBuffers() >> 20) << "MB of it on their own." << std::endl;
+		return -1;
+	}
+
 	FileList.push_back("prboomp_enemy.c");
 	FileList.push_back("chocolatedoomp_enemy.c");
 
@@ -639,7 +2171,7 @@ int main(int argc, char** argv)
 		//return -1;
 	}
 
-	if (!dashDiff.openForComparison(FileList[0].c_str(), FileList[1].c_str()))
+	if (!dashDiff.isStreaming() && !dashDiff.openForComparison(FileList[0].c_str(), FileList[1].c_str()))
 	{
 		std::cout << "Failed to open files for comparison." << std::endl;
 		return -1;
@@ -655,30 +2187,28 @@ int main(int argc, char** argv)
 
 	std::cout << "Processing differences between " << FileList[0] << " and " << FileList[1] << std::endl;
 
-	// The first line in the file is going to be the old file name.
-	patchFileStream << FileList[0] << std::endl;
-	// followed by the new file name.
-	patchFileStream << FileList[1] << std::endl;
-
-	dashDiff.readIntoBuffers();
-	dashDiff.dumpBuffersintoArray();
-	dashDiff.sortRanges();
-    dashDiff.writeToPatchFile(&patchFileStream);
+	if (dashDiff.isStreaming())
+	{
+		if (!dashDiff.streamToPatchFile(FileList[0].c_str(), FileList[1].c_str(), &patchFileStream))
+		{
+			std::cout << "Failed to open files for comparison. With --memory the old file has to be a regular file that can be mapped, so it can't be a pipe or used with --no-mmap." << std::endl;
+			patchFileStream.close();
+			std::remove(patchFile.c_str());
+			return -1;
+		}
+	}
+	else
+	{
+		dashDiff.readIntoBuffers();
+		dashDiff.findMatches();
+		dashDiff.sortRanges();
+		dashDiff.writeToPatchFile(&patchFileStream);
+	}
 
 	// Close the patch file.
 	patchFileStream.close();
 
-	dashDiff::differencesReport report = dashDiff.getReport();
-
-	std::cout << std::endl << "Differences Report:" << std::endl;
-	std::cout << "Old File Size: " << report.oldFileSize << std::endl;
-	std::cout << "New File Size: " << report.newFileSize << std::endl;
-	std::cout << "Characters Deleted: " << report.deletedCharacters << std::endl;
-	std::cout << "Characters Deleted (Percentage of old Document):" << (float)report.deletedCharacters / (float)report.oldFileSize * 100.0f << "%" << std::endl;
-	std::cout << "Characters Inserted: " << report.insertedCharacters << std::endl;
-	std::cout << "Characters Inserted (Percentage of new Document):" << (float)report.insertedCharacters / (float)report.newFileSize * 100.0f << "%" << std::endl;
-	std::cout << "Characters Same: " << report.sameCharacters << std::endl;
-	std::cout << "Characters Same (Percentage of old Document):" << (float)report.sameCharacters / (float)report.oldFileSize * 100.0f << "%" << std::endl;
+	printReport(dashDiff.getReport());
 
 	return 0;
 }
\ No newline at end of file
@@ -1,12 +1,37 @@
 #pragma once
 
 #include <vector>
+#include <map>
 #include <mutex>
 #include <fstream>
 #include <chrono>
+#include <cstdint>
+#include <memory>
+#include <atomic>
+#include <string>
 
+#include "dashPool.h"
+#include "dashFile.h"
+#include "dashPatch.h"
 
-#define THREADCOUNT 10
+#define MINIMUMMATCH 5				// Shortest match worth a S[n] token, also the k-gram length the byte bucket engine seeds on.
+#define BINARYMINIMUMMATCH 4		// The same for the binary format, where a S[n] token is 2 bytes for most lengths.
+#define ROLLINGHASHBLOCK 32		// Block size indexed in the old file by the rolling hash engine.
+#define ROLLINGHASHCANDIDATES 16	// Most old blocks we'll verify for a single hash hit, keeps repetitive input linear.
+#define HISTOGRAMMAXCHAIN 64		// Lines occurring more often than this in the old file are never used as anchors.
+#define HISTOGRAMPARALLELLINES 1024	// Gaps between anchors smaller than this aren't worth a thread of their own.
+#define OVERLAPTRIMWINDOW 8			// How many preceding ranges reduceOverlaps tries trimming a range against.
+#define SEEDTILESPERWORKER 8		// Byte bucket work is cut into about this many tiles per worker, so there's always something to steal.
+#define SEEDTILEMINIMUM 65536		// Fewest seed pairs worth a tile of their own, below this the queueing costs more than it saves.
+#define SEEDBLOCKOLD 64				// Old seeds sharing a k-gram that are walked together against one cached slice of new seeds.
+#define SEEDBLOCKNEW 256			// New seeds in that slice, 256 cache lines of text sits comfortably in L1.
+#define SEEDPREFETCH 8				// How many new seeds ahead the first pass over a slice prefetches text.
+#define PROGRESSINTERVAL 250		// Milliseconds between progress line redraws while the byte bucket engine runs.
+#define APPLYPIECESPERWORKER 4		// Patches with an index are applied in about this many pieces per worker.
+#define APPLYPIECEMINIMUM (4 << 20)	// Fewest bytes of output worth a piece of their own.
+#define STREAMINDEXENTRY 16			// Bytes per old block in the streaming mode's index, a 64 bit hash and a 64 bit offset.
+#define STREAMJUMPRATIO 16			// Most old bytes per matched byte a streaming match may skip over ahead of the cursor.
+#define STREAMJUMPBLOCKS 16			// Blocks a streaming match has to run to be taken however far ahead of the cursor it is.
 
 namespace dashDiff
 {
@@ -21,15 +46,37 @@ namespace dashDiff
 		size_t sameCharacters;
 	};
 
+	// Selects the algorithm used to find the common ranges between the two files.
+	enum class matchEngine
+	{
+		byteBuckets,	// Every occurrence of a byte in the old file against every occurrence in the new file.
+		suffixArray,	// Suffix array + LCP over both buffers, emitting maximal common substrings.
+		rollingHash,	// Rabin-Karp hashed blocks of the old file, the new file scanned once against them.
+		myersLines,		// Myers O(ND) diff over whole lines rather than characters.
+		histogramLines	// Git style histogram diff, anchored on the rarest lines, Myers for anything without an anchor.
+	};
+
+	// How applying a patch went. Whatever was at the output path is only replaced once the patch has applied.
+	enum class applyResult
+	{
+		applied,
+		unreadable,		// The patch or the old file couldn't be opened.
+		unwritable,		// The output couldn't be created or written.
+		damaged,		// The patch doesn't parse, or its ops run past the end of either file.
+		wrongOldFile,	// The old file isn't the one the patch was made against.
+		wrongSize,		// The ops don't add up to the new file size in the header.
+		wrongChecksum	// The result doesn't match the new file the patch was made from.
+	};
+
 	class characterRange
 	{
 	public:
-		char* start;
-		char* reference;
-		char* end;
+		const char* start;
+		const char* reference;
+		const char* end;
 
-		char* min;
-		char* max;
+		const char* min;
+		const char* max;
 
 		size_t sizeofRange(void)
 		{
@@ -71,102 +118,243 @@ namespace dashDiff
 		}
 	};
 
-	class fileByteBuffer
+	// A thread's accepted matches, indexed by where they start on each side. The ranges never overlap one another on either
+	// side, so anything overlapping a candidate sits right around the candidate's start in each map and is found in O(log n).
+	class rangeIndex
 	{
-	public:
-		// We're allocating a SINGLE char buffer to store the file in, and then we're going to reference it with pointers.
-		std::vector<characterRange> pointerBuffer;
+	private:
+		std::map<const char*, dualRange> byOldStart;
+		std::map<const char*, const char*> byNewStart; // New start to old start, the key into byOldStart.
 
-		void add(char* reference, char* start, char* end, char* min, char* max)
+	public:
+		// Adds the candidate unless something it overlaps is at least as big. Anything smaller it overlaps is dropped,
+		// the bigger range wins just like in reduceOverlaps.
+		bool insert(const dualRange& candidate)
 		{
-			characterRange aChar;
-			aChar.reference = reference;
-			aChar.start = start;
-			aChar.end = end;
-			aChar.min = min;
-			aChar.max = max;
-
-			pointerBuffer.push_back(aChar);
-		}
+			std::vector<const char*> overlapping;
 
-		// Overrides for > and < and == operators
-		// These are for integration into other STL containers if we go that route.
-		bool operator>(const fileByteBuffer& other) const
-		{
-			return pointerBuffer.size() > other.pointerBuffer.size();
+			auto oldIt = byOldStart.lower_bound(candidate.oldRange.start);
+			if (oldIt != byOldStart.begin() && std::prev(oldIt)->second.oldRange.end > candidate.oldRange.start)
+				oldIt--;
+			for (; oldIt != byOldStart.end() && oldIt->first < candidate.oldRange.end; oldIt++)
+			{
+				if (oldIt->second.rangeSize >= candidate.rangeSize)
+					return false;
+				overlapping.push_back(oldIt->first);
+			}
+
+			auto newIt = byNewStart.lower_bound(candidate.newRange.start);
+			if (newIt != byNewStart.begin() && byOldStart.find(std::prev(newIt)->second)->second.newRange.end > candidate.newRange.start)
+				newIt--;
+			for (; newIt != byNewStart.end() && newIt->first < candidate.newRange.end; newIt++)
+			{
+				if (byOldStart.find(newIt->second)->second.rangeSize >= candidate.rangeSize)
+					return false;
+				overlapping.push_back(newIt->second);
+			}
+
+			for (const char* key : overlapping)
+			{
+				auto entry = byOldStart.find(key);
+
+				if (entry == byOldStart.end())
+					continue; // Overlapped on both sides, already gone.
+
+				byNewStart.erase(entry->second.newRange.start);
+				byOldStart.erase(entry);
+			}
+
+			byOldStart.emplace(candidate.oldRange.start, candidate);
+			byNewStart.emplace(candidate.newRange.start, candidate.oldRange.start);
+			return true;
 		}
-		bool operator<(const fileByteBuffer& other) const
+
+		size_t size(void)
 		{
-			return pointerBuffer.size() < other.pointerBuffer.size();
+			return byOldStart.size();
 		}
-		bool operator==(const fileByteBuffer& other) const
+
+		void appendTo(std::vector<dualRange>& ranges)
 		{
-			return pointerBuffer.size() == other.pointerBuffer.size();
+			for (auto& entry : byOldStart)
+				ranges.push_back(entry.second);
 		}
 	};
 
-	class threadRequest
+	// What a worker's current byte bucket task is up to, published with atomics so the progress line and the other
+	// workers can read it while it runs. splitRequests goes the other way, idle workers raise it to ask the task to
+	// hand half of its remaining old seeds back to the pool.
+	struct taskStatus
+	{
+		std::atomic<size_t> oldSeedsDone;
+		std::atomic<size_t> oldSeedsTotal;	// 0 while the worker has no task.
+		std::atomic<size_t> seedPairs;		// Every (old, new) seed pair looked at, across all of this worker's tasks.
+		std::atomic<int> splitRequests;
+	};
+
+	// A rectangle of the byte bucket engine's seed cross product: old seeds [oldBegin, oldEnd) of a bucket against new seeds
+	// [newBegin, newEnd) of the same bucket. cost is how many seed pairs it holds that share a k-gram, i.e. how many extend.
+	struct seedTile
+	{
+		int bucket;
+		size_t oldBegin;
+		size_t oldEnd;
+		size_t newBegin;
+		size_t newEnd;
+		size_t cost;
+	};
+
+	// A match found by the streaming mode, newStart is a position in its window of the new file.
+	struct streamMatch
+	{
+		size_t newStart;
+		size_t oldStart;
+		size_t length;
+	};
+
+	// Line granular view of both files for the line based engines. Every distinct line is interned to an id,
+	// so comparing two lines is a single integer compare.
+	struct lineTable
+	{
+		std::vector<unsigned int> oldLines;
+		std::vector<unsigned int> newLines;
+		std::vector<const char*> oldLineStart; // One extra entry on the end, marking where the last line stops.
+		std::vector<const char*> newLineStart;
+	};
+
+	// Seeds are stored as offsets into their file rather than pointers, a quarter of the size on 64 bit builds.
+	// Define DASHDIFF_LARGEFILES to index files of 4 GB and up.
+#ifdef DASHDIFF_LARGEFILES
+	typedef uint64_t seedOffset;
+#else
+	typedef uint32_t seedOffset;
+#endif
+
+	// Every seed of one file in a single contiguous allocation, grouped by bucket (CSR layout).
+	// Bucket b is the view offsets[bucketStart[b]] up to offsets[bucketStart[b + 1]].
+	class seedIndex
 	{
-	private:
-		inline static 	std::mutex threadRequestMutex;
 	public:
-		int threadId;
+		std::vector<seedOffset> offsets;
+		size_t bucketStart[257];
 
-		threadRequest()
+		seedOffset* bucketBegin(int bucket)
 		{
-			threadId = -1;
+			return offsets.data() + bucketStart[bucket];
+		}
 
-			// Making sure that for the lifetime of this object, no other thread can request a thread.
-			threadRequestMutex.lock();
+		seedOffset* bucketEnd(int bucket)
+		{
+			return offsets.data() + bucketStart[bucket + 1];
 		}
 
-		~threadRequest()
+		size_t bucketSize(int bucket)
 		{
-			threadRequestMutex.unlock();
+			return bucketStart[bucket + 1] - bucketStart[bucket];
 		}
 	};
 
 	class dashDiff
 	{
 	private:
-		// File stream handles for comparison.
-		std::fstream oldFile;
-		std::fstream newFile;
+		// The files being compared, mapped when they can be.
+		mappedFile oldFile;
+		mappedFile newFile;
+		bool useMapping;
+		size_t memoryBudget; // Non zero switches to streaming the new file through in windows, see streamToPatchFile.
+		std::string oldFilePath;
+		std::string newFilePath;
 
-		char* oldFileBuffer;
-		char* newFileBuffer;
+		// The patch format decides how short a match can be and still pay for its tokens.
+		patchFormat format;
+		size_t minimumMatch;
+
+		const char* oldFileBuffer;
+		const char* newFileBuffer;
 		size_t oldFileBufferSize;
 		size_t newFileBufferSize;
 
-		fileByteBuffer oldFileBufferArray[256];
-		fileByteBuffer newFileBufferArray[256];
+		seedIndex oldSeeds;
+		seedIndex newSeeds;
 
 		std::vector<dualRange> rangeVector;
-		std::mutex rangeVectorMutex;
 		std::mutex bufferMutex;
 
-		bool threadActive[THREADCOUNT];
-		int threadPercent[THREADCOUNT];
+		// Every byte bucket task leaves its matches as a run sorted by old offset in its worker's slot, the last slot is for
+		// callers outside the pool. Nothing is shared until mergeRuns puts them all together at the end.
+		std::vector<std::vector<std::vector<dualRange>>> workerRuns;
+		std::atomic<size_t> matchCount;
+
+		// Workers are started the first time something needs them and kept for the life of the object.
+		size_t threadCount;
+		std::unique_ptr<workPool> pool;
+		std::unique_ptr<taskStatus[]> taskStatuses; // One per worker.
 
 		differencesReport report;
+		matchEngine engine;
+
+		// A k-gram key to binary search a bucket for. Wrapped so it can't be mistaken for a 64 bit seedOffset.
+		struct gramProbe
+		{
+			uint64_t key;
+		};
+
+		// Orders seeds in one file by the k-gram they start, for binary searching a bucket with a gramProbe.
+		struct gramOrder
+		{
+			const char* buffer;
+			size_t length;
+
+			bool operator()(seedOffset a, gramProbe probe) const { return gramKey(buffer + a, length) < probe.key; }
+			bool operator()(gramProbe probe, seedOffset b) const { return probe.key < gramKey(buffer + b, length); }
+		};
 
-		threadRequest* threadDistributer(void);
-		bool threadsActive(void);
-		bool valuesOverlap(characterRange& a, characterRange& b);
-		void removeWeakOverlaps(void);
-		void removeOverlapEntry(int* it);
+		workPool& workers(void);
+		void requestSplit(void);
+		void planSeedTiles(std::vector<seedTile>& tiles);
+		void mergeRuns(void);
+		void chainRanges(void);
 		void reduceOverlaps(void);
+		static uint64_t gramKey(const char* position, size_t length);
+		static int gramBucket(const char* position, size_t length);
+		void buildSeedIndex(seedIndex& index, const char* buffer, size_t bufferSize);
+		uint64_t checksumBuffer(const char* data, size_t length);
+		applyResult applyOps(patchReader reader, patchCheckpoint& at, uint64_t patchEnd, char* outputData, uint64_t newSize, differencesReport& counts);
+		dualRange makeRange(const char* oldStart, const char* newStart, size_t length);
+		dualRange expandMatch(const char* oldSeed, const char* newSeed);
+		void findCommonRangesRollingHash(void);
+		void buildLineTable(lineTable& lines);
+		void myersLines(lineTable& lines, size_t oldStart, size_t oldEnd, size_t newStart, size_t newEnd,
+			std::vector<ptrdiff_t>& forward, std::vector<ptrdiff_t>& reverse, std::vector<std::pair<size_t, size_t>>& matchedLines);
+		void lineMatchesToRanges(lineTable& lines, std::vector<std::pair<size_t, size_t>>& matchedLines);
+		void findCommonRangesMyers(void);
+		void histogramLines(lineTable& lines, size_t oldStart, size_t oldEnd, size_t newStart, size_t newEnd, size_t spareThreads,
+			std::vector<std::pair<size_t, size_t>>& matchedLines);
+		void findCommonRangesHistogram(void);
+		void runMatchEngine(void);
+		void buildSuffixArray(std::vector<unsigned int>& suffixArray, std::vector<unsigned int>& lcpArray);
+		void findCommonRangesSuffixArray(void);
 
 	public:
 
 		differencesReport getReport(void);
-		void findCommonRanges(int i, int athread, int rangeStart, int rangeEnd);
+		void setMatchEngine(matchEngine aEngine);
+		void setThreadCount(size_t aThreadCount);
+		void setMemoryMapping(bool aUseMapping);
+		void setMemoryBudget(size_t aMemoryBudget);
+		void setPatchFormat(patchFormat aFormat);
+		bool isStreaming(void);
+		size_t streamingBuffers(void); // Bytes of the memory budget streamToPatchFile needs whatever the files are.
+		void findMatches(void);
+		void findCommonRanges(int i, size_t rangeStart, size_t rangeEnd, size_t newBegin, size_t newEnd);
 		void progressToConsole(std::chrono::time_point<std::chrono::system_clock> startOperations);
 		void dumpBuffersintoArray(void);
 		void sortRanges(void);
 		void readIntoBuffers(void);
 		bool openForComparison(const char* oldFilePath, const char* newFilePath);
 		void writeToPatchFile(std::fstream* afileStream);
+		bool streamToPatchFile(const char* oldFilePath, const char* newFilePath, std::fstream* afileStream);
+		applyResult applyPatchFile(const char* patchPath, const char* oldPath, const char* outputPath);
 		void displayDifferences(void);
 
 		dashDiff();
@@ -0,0 +1,270 @@
+#include <cstdint>
+
+#include "dashExtend.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define DASHDIFF_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DASHDIFF_X64 // AVX-512 masks are 64 bits wide, we only bother with it on 64 bit builds.
+#endif
+
+// MSVC lets us use any intrinsic anywhere, GCC and Clang want the function tagged with the instruction set.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define DASHDIFF_TARGET(isa)
+#else
+#define DASHDIFF_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+namespace dashDiff
+{
+	typedef size_t(*matchKernel)(const char* a, const char* b, size_t limit);
+
+	static unsigned int lowestBit(uint32_t mask)
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	static unsigned int highestBit(uint32_t mask)
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		unsigned long index;
+		_BitScanReverse(&index, mask);
+		return index;
+#else
+		return 31 - __builtin_clz(mask);
+#endif
+	}
+
+	static size_t forwardScalar(const char* a, const char* b, size_t limit)
+	{
+		size_t i = 0;
+
+		while (i < limit && a[i] == b[i])
+			i++;
+
+		return i;
+	}
+
+	static size_t backwardScalar(const char* a, const char* b, size_t limit)
+	{
+		size_t i = 0;
+
+		while (i < limit && a[-(ptrdiff_t)i - 1] == b[-(ptrdiff_t)i - 1])
+			i++;
+
+		return i;
+	}
+
+#ifdef DASHDIFF_X86
+	// Each kernel compares a whole register of bytes at once and turns the result into a bit mask of mismatches.
+	// Going forwards the first mismatch is the lowest set bit, going backwards it's the highest. Whatever is
+	// left over at the end is done a byte at a time.
+
+	static size_t forwardSSE2(const char* a, const char* b, size_t limit)
+	{
+		size_t i = 0;
+
+		for (; i + 16 <= limit; i += 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+			__m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+			uint32_t mismatch = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+
+			if (mismatch)
+				return i + lowestBit(mismatch);
+		}
+
+		return i + forwardScalar(a + i, b + i, limit - i);
+	}
+
+	static size_t backwardSSE2(const char* a, const char* b, size_t limit)
+	{
+		size_t i = 0;
+
+		for (; i + 16 <= limit; i += 16)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i*)(a - i - 16));
+			__m128i y = _mm_loadu_si128((const __m128i*)(b - i - 16));
+			uint32_t mismatch = ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+
+			if (mismatch)
+				return i + 15 - highestBit(mismatch);
+		}
+
+		return i + backwardScalar(a - i, b - i, limit - i);
+	}
+
+	DASHDIFF_TARGET("avx2")
+	static size_t forwardAVX2(const char* a, const char* b, size_t limit)
+	{
+		size_t i = 0;
+
+		for (; i + 32 <= limit; i += 32)
+		{
+			__m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+			__m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+			uint32_t mismatch = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+			if (mismatch)
+				return i + lowestBit(mismatch);
+		}
+
+		return i + forwardSSE2(a + i, b + i, limit - i);
+	}
+
+	DASHDIFF_TARGET("avx2")
+	static size_t backwardAVX2(const char* a, const char* b, size_t limit)
+	{
+		size_t i = 0;
+
+		for (; i + 32 <= limit; i += 32)
+		{
+			__m256i x = _mm256_loadu_si256((const __m256i*)(a - i - 32));
+			__m256i y = _mm256_loadu_si256((const __m256i*)(b - i - 32));
+			uint32_t mismatch = ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+			if (mismatch)
+				return i + 31 - highestBit(mismatch);
+		}
+
+		return i + backwardSSE2(a - i, b - i, limit - i);
+	}
+
+#ifdef DASHDIFF_X64
+	static unsigned int lowestBit64(uint64_t mask)
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		unsigned long index;
+		_BitScanForward64(&index, mask);
+		return index;
+#else
+		return __builtin_ctzll(mask);
+#endif
+	}
+
+	static unsigned int highestBit64(uint64_t mask)
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		unsigned long index;
+		_BitScanReverse64(&index, mask);
+		return index;
+#else
+		return 63 - __builtin_clzll(mask);
+#endif
+	}
+
+	DASHDIFF_TARGET("avx512f,avx512bw")
+	static size_t forwardAVX512(const char* a, const char* b, size_t limit)
+	{
+		size_t i = 0;
+
+		for (; i + 64 <= limit; i += 64)
+		{
+			__m512i x = _mm512_loadu_si512((const void*)(a + i));
+			__m512i y = _mm512_loadu_si512((const void*)(b + i));
+			uint64_t mismatch = _mm512_cmpneq_epi8_mask(x, y);
+
+			if (mismatch)
+				return i + lowestBit64(mismatch);
+		}
+
+		return i + forwardAVX2(a + i, b + i, limit - i);
+	}
+
+	DASHDIFF_TARGET("avx512f,avx512bw")
+	static size_t backwardAVX512(const char* a, const char* b, size_t limit)
+	{
+		size_t i = 0;
+
+		for (; i + 64 <= limit; i += 64)
+		{
+			__m512i x = _mm512_loadu_si512((const void*)(a - i - 64));
+			__m512i y = _mm512_loadu_si512((const void*)(b - i - 64));
+			uint64_t mismatch = _mm512_cmpneq_epi8_mask(x, y);
+
+			if (mismatch)
+				return i + 63 - highestBit64(mismatch);
+		}
+
+		return i + backwardAVX2(a - i, b - i, limit - i);
+	}
+#endif
+
+	// 0 = SSE2, 1 = AVX2, 2 = AVX-512BW. SSE2 is part of x64 so it's always there.
+	static int detectKernelLevel(void)
+	{
+		int level = 0;
+#if defined(_MSC_VER) && !defined(__clang__)
+		int info[4];
+
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return level;
+
+		__cpuid(info, 1);
+		bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6;
+		bool osSavesZmm = osSavesYmm && (_xgetbv(0) & 0xE6) == 0xE6;
+
+		__cpuidex(info, 7, 0);
+		if (osSavesYmm && (info[1] & (1 << 5)))
+			level = 1;
+		if (osSavesZmm && (info[1] & (1 << 16)) && (info[1] & (1 << 30)))
+			level = 2;
+#else
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			level = 1;
+		if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+			level = 2;
+#endif
+		return level;
+	}
+
+	static const int kernelLevel = detectKernelLevel();
+#ifdef DASHDIFF_X64
+	static const matchKernel forwardKernel = kernelLevel == 2 ? forwardAVX512 : kernelLevel == 1 ? forwardAVX2 : forwardSSE2;
+	static const matchKernel backwardKernel = kernelLevel == 2 ? backwardAVX512 : kernelLevel == 1 ? backwardAVX2 : backwardSSE2;
+#else
+	static const matchKernel forwardKernel = kernelLevel >= 1 ? forwardAVX2 : forwardSSE2;
+	static const matchKernel backwardKernel = kernelLevel >= 1 ? backwardAVX2 : backwardSSE2;
+#endif
+#else
+	static const matchKernel forwardKernel = forwardScalar;
+	static const matchKernel backwardKernel = backwardScalar;
+#endif
+
+	size_t matchForward(const char* a, const char* b, size_t limit)
+	{
+		return forwardKernel(a, b, limit);
+	}
+
+	size_t matchBackward(const char* a, const char* b, size_t limit)
+	{
+		return backwardKernel(a, b, limit);
+	}
+
+	const char* matchKernelName(void)
+	{
+#ifdef DASHDIFF_X86
+#ifdef DASHDIFF_X64
+		if (kernelLevel == 2)
+			return "AVX-512";
+#endif
+		return kernelLevel >= 1 ? "AVX2" : "SSE2";
+#else
+		return "scalar";
+#endif
+	}
+}
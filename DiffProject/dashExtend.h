@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(_MSC_VER) && !defined(__clang__) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#endif
+
+namespace dashDiff
+{
+	// Match extension kernels, the innermost loop of every engine that grows a seed into a match.
+	// matchForward counts how many bytes agree starting at a and b, matchBackward how many agree
+	// walking back from the bytes just before a and b. Neither looks more than limit bytes away.
+	// The widest instruction set the CPU supports (SSE2, AVX2 or AVX-512) is picked at startup.
+	size_t matchForward(const char* a, const char* b, size_t limit);
+	size_t matchBackward(const char* a, const char* b, size_t limit);
+
+	// Name of the kernel set picked for this CPU, for the console.
+	const char* matchKernelName(void);
+
+	// Tells the CPU we're about to read from p, so the cache line is on its way before the loop gets there.
+	inline void prefetchRead(const void* p)
+	{
+#if defined(_MSC_VER) && !defined(__clang__) && (defined(_M_X64) || defined(_M_IX86))
+		_mm_prefetch((const char*)p, _MM_HINT_T0);
+#elif defined(__GNUC__) || defined(__clang__)
+		__builtin_prefetch(p, 0, 3);
+#else
+		(void)p;
+#endif
+	}
+}
@@ -0,0 +1,353 @@
+#include <fstream>
+#include <cstdio>
+#include <cerrno>
+
+#include "dashFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace dashDiff
+{
+	bool mappedFile::map(const char* path)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER fileSize;
+
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		if (GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &fileSize) || (unsigned long long)fileSize.QuadPart > (size_t)-1)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		// There's no such thing as an empty view, but there's nothing to map either.
+		if (fileSize.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return true;
+		}
+
+		// The view keeps the mapping alive on its own, neither handle is needed once it exists.
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (mapping == nullptr)
+			return false;
+
+		view = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (view == nullptr)
+			return false;
+
+		viewSize = (size_t)fileSize.QuadPart;
+		return true;
+#else
+		int file = ::open(path, O_RDONLY);
+		struct stat fileStat;
+
+		if (file < 0)
+			return false;
+
+		if (fstat(file, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+		{
+			::close(file);
+			return false;
+		}
+
+		// There's no such thing as an empty mapping, but there's nothing to map either.
+		if (fileStat.st_size == 0)
+		{
+			::close(file);
+			return true;
+		}
+
+		// Read only, a writable private mapping would be charged against the commit limit in full and big files would fail.
+		void* address = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		::close(file);
+		if (address == MAP_FAILED)
+			return false;
+
+		view = (const char*)address;
+		viewSize = (size_t)fileStat.st_size;
+		return true;
+#endif
+	}
+
+	bool mappedFile::readAll(const char* path)
+	{
+		std::ifstream file(path, std::ios::in | std::ios::binary);
+		size_t length = 0;
+
+		if (!file.is_open())
+			return false;
+
+		// No seeking, a pipe can't tell us its size, so grow the buffer until the data stops coming.
+		buffer.resize(1 << 20);
+		while (file.read(buffer.data() + length, buffer.size() - length) || file.gcount() > 0)
+		{
+			length += (size_t)file.gcount();
+			if (length == buffer.size())
+				buffer.resize(buffer.size() * 2);
+		}
+
+		if (file.bad())
+			return false;
+
+		buffer.resize(length);
+		view = buffer.data();
+		viewSize = length;
+		return true;
+	}
+
+	bool mappedFile::open(const char* path, bool allowMapping)
+	{
+		close();
+
+		if (allowMapping && map(path))
+			mapped = true;
+		else if (!readAll(path))
+			return false;
+
+		opened = true;
+		return true;
+	}
+
+	bool mappedFile::openMapped(const char* path)
+	{
+		close();
+
+		if (!map(path))
+			return false;
+
+		opened = mapped = true;
+		return true;
+	}
+
+	void mappedFile::close(void)
+	{
+		if (mapped && view != nullptr)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(view);
+#else
+			munmap((void*)view, viewSize);
+#endif
+		}
+
+		std::vector<char>().swap(buffer);
+		view = nullptr;
+		viewSize = 0;
+		opened = mapped = false;
+	}
+
+	bool mappedFile::isOpen(void)
+	{
+		return opened;
+	}
+
+	bool mappedFile::isMapped(void)
+	{
+		return mapped;
+	}
+
+	const char* mappedFile::data(void)
+	{
+		return view;
+	}
+
+	size_t mappedFile::size(void)
+	{
+		return viewSize;
+	}
+
+	void mappedFile::advise(accessPattern pattern)
+	{
+#ifndef _WIN32
+		if (mapped && viewSize > 0)
+			posix_madvise((void*)view, viewSize, pattern == accessPattern::sequential ? POSIX_MADV_SEQUENTIAL : POSIX_MADV_RANDOM);
+#else
+		(void)pattern; // Windows only takes read ahead hints when the file is opened, and the cache manager copes fine.
+#endif
+	}
+
+	mappedFile::mappedFile()
+	{
+		view = nullptr;
+		viewSize = 0;
+		opened = mapped = false;
+	}
+
+	mappedFile::~mappedFile()
+	{
+		close();
+	}
+
+	bool mappedOutput::create(const char* aPath, size_t size)
+	{
+		discard();
+		path = aPath;
+
+		// The temporary goes in the same directory so the rename at the end stays on one filesystem.
+#ifdef _WIN32
+		std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+		char temporaryName[MAX_PATH];
+
+		if (GetTempFileNameA(directory.empty() ? "." : directory.c_str(), "dph", 0, temporaryName) == 0)
+			return false;
+		temporaryPath = temporaryName;
+
+		HANDLE file = CreateFileA(temporaryName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			discard();
+			return false;
+		}
+
+		// An empty file can't be mapped, but it doesn't need to be either.
+		if (size > 0)
+		{
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, nullptr);
+
+			if (mapping != nullptr)
+			{
+				view = (char*)MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+				CloseHandle(mapping);
+			}
+			if (view == nullptr)
+			{
+				CloseHandle(file);
+				discard();
+				return false;
+			}
+		}
+		CloseHandle(file);
+#else
+		std::vector<char> temporaryName(path.begin(), path.end());
+		const char suffix[] = ".XXXXXX";
+
+		temporaryName.insert(temporaryName.end(), suffix, suffix + sizeof(suffix));
+
+		int file = mkstemp(temporaryName.data());
+
+		if (file < 0)
+			return false;
+		temporaryPath = temporaryName.data();
+
+		// mkstemp makes it private to us, give it the permissions a new file would normally get.
+		mode_t mask = umask(0);
+		umask(mask);
+		fchmod(file, 0666 & ~mask);
+
+		if (size > 0)
+		{
+			// Reserve the blocks now rather than leave it sparse. Writes through a shared mapping have no way to report a
+			// full disk, the process just takes a SIGBUS partway through. Only a filesystem that can't preallocate at all
+			// gets a sparse file.
+			int reserved = posix_fallocate(file, 0, (off_t)size);
+
+			if (reserved == EOPNOTSUPP)
+				reserved = ftruncate(file, (off_t)size) == 0 ? 0 : errno;
+
+			void* address = reserved == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+
+			if (address == MAP_FAILED)
+			{
+				::close(file);
+				discard();
+				return false;
+			}
+			view = (char*)address;
+		}
+		::close(file);
+#endif
+
+		viewSize = size;
+		return true;
+	}
+
+	bool mappedOutput::unmap(bool flush)
+	{
+		bool flushed = true;
+
+		if (view != nullptr)
+		{
+#ifdef _WIN32
+			if (flush)
+				flushed = FlushViewOfFile(view, 0) != 0;
+			UnmapViewOfFile(view);
+#else
+			// Waits for the pages to be written back, so a write error shows up here and not after the rename.
+			if (flush)
+				flushed = msync(view, viewSize, MS_SYNC) == 0;
+			munmap(view, viewSize);
+#endif
+		}
+
+		view = nullptr;
+		viewSize = 0;
+		return flushed;
+	}
+
+	bool mappedOutput::commit(void)
+	{
+		if (temporaryPath.empty())
+			return false;
+
+#ifdef _WIN32
+		bool placed = unmap(true) && MoveFileExA(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		bool placed = unmap(true) && rename(temporaryPath.c_str(), path.c_str()) == 0;
+#endif
+
+		if (!placed)
+		{
+			discard();
+			return false;
+		}
+
+		temporaryPath.clear();
+		return true;
+	}
+
+	void mappedOutput::discard(void)
+	{
+		unmap(false);
+
+		if (!temporaryPath.empty())
+			std::remove(temporaryPath.c_str());
+		temporaryPath.clear();
+	}
+
+	char* mappedOutput::data(void)
+	{
+		return view;
+	}
+
+	size_t mappedOutput::size(void)
+	{
+		return viewSize;
+	}
+
+	mappedOutput::mappedOutput()
+	{
+		view = nullptr;
+		viewSize = 0;
+	}
+
+	mappedOutput::~mappedOutput()
+	{
+		discard();
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace dashDiff
+{
+	// How we're about to walk a file, so the OS can read ahead or hold back.
+	enum class accessPattern
+	{
+		sequential,
+		random
+	};
+
+	// A whole input file in memory. Regular files are mapped straight from the page cache: nothing is copied up front,
+	// pages come in as they're first touched, and concurrent diffs against the same base share them. The mapping is
+	// read only, so it isn't charged against the commit limit and any size of file maps. An empty file counts as mapped
+	// with no view at all. Anything that can't be mapped (pipes, or mapping turned off) is read into a buffer of our own
+	// instead.
+	class mappedFile
+	{
+	private:
+		const char* view;
+		size_t viewSize;
+		bool opened;
+		bool mapped;
+		std::vector<char> buffer;
+
+		bool map(const char* path);
+		bool readAll(const char* path);
+
+	public:
+		bool open(const char* path, bool allowMapping);
+		bool openMapped(const char* path); // Fails rather than read into a buffer, for when the file may not fit in memory.
+		void close(void);
+		bool isOpen(void);
+		bool isMapped(void);
+		const char* data(void);
+		size_t size(void);
+		// A hint only, does nothing for a read buffer or where the OS has no way to take it.
+		void advise(accessPattern pattern);
+
+		mappedFile();
+		~mappedFile();
+
+		mappedFile(const mappedFile&) = delete;
+		mappedFile& operator=(const mappedFile&) = delete;
+	};
+
+	// A file being written, created at its final size with the space for it reserved, and mapped shared so whatever is
+	// copied into the view lands in the file with no write calls of our own. It's built under a temporary name next to the
+	// real one and only renamed into place by commit, once it's been written back, so a failed write never touches what
+	// was at the path, even when that's one of our own inputs. Anything that can't be mapped is an error, there's no
+	// buffer to fall back on when the file is bigger than memory.
+	class mappedOutput
+	{
+	private:
+		char* view;
+		size_t viewSize;
+		std::string path;
+		std::string temporaryPath;
+
+		bool unmap(bool flush);	// False if flush was asked for and the data couldn't be written to the file.
+
+	public:
+		bool create(const char* aPath, size_t size);
+		bool commit(void);	// Puts the finished file in place, false if it couldn't be flushed or renamed.
+		void discard(void);	// Throws away the temporary file, what was at the path is left alone.
+		char* data(void);
+		size_t size(void);
+
+		mappedOutput();
+		~mappedOutput();
+
+		mappedOutput(const mappedOutput&) = delete;
+		mappedOutput& operator=(const mappedOutput&) = delete;
+	};
+}
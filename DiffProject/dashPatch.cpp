@@ -0,0 +1,494 @@
+#include <charconv>
+#include <cstring>
+#include <algorithm>
+
+#include "dashPatch.h"
+
+namespace dashDiff
+{
+	static const char binaryMagic[4] = { 'D', 'P', 'H', 'B' };
+	static const char indexMagic[4] = { 'D', 'P', 'H', 'I' };
+	static const size_t fixedHeaderSize = 40;
+	static const size_t checkpointSize = 24;
+	static const size_t indexTrailerSize = 12;	// The checkpoint count and the magic.
+
+	static uint64_t rotateLeft(uint64_t value, int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	static uint64_t mixWord(uint64_t lane, uint64_t word)
+	{
+		return rotateLeft(lane ^ (word * 0x87C37B91114253D5ull), 31) * 0x4CF5AD432745937Full;
+	}
+
+	static uint64_t avalanche(uint64_t value)
+	{
+		value ^= value >> 33;
+		value *= 0xFF51AFD7ED558CCDull;
+		value ^= value >> 33;
+		value *= 0xC4CEB9FE1A85EC53ull;
+		value ^= value >> 33;
+		return value;
+	}
+
+	static void putLittleEndian(char* out, uint64_t value)
+	{
+		for (int i = 0; i < 8; i++)
+			out[i] = (char)(value >> (i * 8));
+	}
+
+	static uint64_t getLittleEndian(const char* in)
+	{
+		uint64_t value = 0;
+
+		for (int i = 7; i >= 0; i--)
+			value = (value << 8) | (unsigned char)in[i];
+		return value;
+	}
+
+	uint64_t patchChecksum::hashBlock(const char* data, size_t length)
+	{
+		// Four independent lanes so the multiplies overlap instead of waiting on each other.
+		uint64_t lane[4] = { 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull };
+		size_t i = 0;
+
+		for (; i + 32 <= length; i += 32)
+		{
+			for (int l = 0; l < 4; l++)
+			{
+				uint64_t word;
+
+				memcpy(&word, data + i + l * 8, 8);
+				lane[l] = mixWord(lane[l], word);
+			}
+		}
+
+		for (int l = 0; i < length; i += 8, l = (l + 1) & 3)
+		{
+			uint64_t word = 0;
+
+			memcpy(&word, data + i, std::min<size_t>(8, length - i));
+			lane[l] = mixWord(lane[l], word);
+		}
+
+		return avalanche(rotateLeft(lane[0], 1) + rotateLeft(lane[1], 7) + rotateLeft(lane[2], 12) + rotateLeft(lane[3], 18) + length);
+	}
+
+	uint64_t patchChecksum::ofBuffer(const char* data, size_t length)
+	{
+		patchChecksum checksum;
+
+		checksum.update(data, length);
+		return checksum.value();
+	}
+
+	void patchChecksum::combine(uint64_t blockHash, size_t blockLength)
+	{
+		state = mixWord(state, blockHash);
+		totalLength += blockLength;
+	}
+
+	void patchChecksum::update(const char* data, size_t length)
+	{
+		// Top up a block left unfinished by the last call first.
+		if (!pending.empty())
+		{
+			size_t take = std::min(length, (size_t)CHECKSUMBLOCK - pending.size());
+
+			pending.insert(pending.end(), data, data + take);
+			data += take;
+			length -= take;
+
+			if (pending.size() < CHECKSUMBLOCK)
+				return;
+
+			combine(hashBlock(pending.data(), pending.size()), pending.size());
+			pending.clear();
+		}
+
+		// Whole blocks are hashed where they lie, only a trailing piece gets copied.
+		for (; length >= CHECKSUMBLOCK; data += CHECKSUMBLOCK, length -= CHECKSUMBLOCK)
+			combine(hashBlock(data, CHECKSUMBLOCK), CHECKSUMBLOCK);
+
+		pending.assign(data, data + length);
+	}
+
+	uint64_t patchChecksum::value(void)
+	{
+		uint64_t finalState = state, finalLength = totalLength;
+
+		if (!pending.empty())
+		{
+			finalState = mixWord(finalState, hashBlock(pending.data(), pending.size()));
+			finalLength += pending.size();
+		}
+
+		return avalanche(finalState ^ finalLength);
+	}
+
+	patchChecksum::patchChecksum()
+	{
+		state = 0x243F6A8885A308D3ull;
+		totalLength = 0;
+	}
+
+	void patchWriter::varint(uint64_t value)
+	{
+		if (buffer.size() - used < 10)
+			flush();
+
+		do
+		{
+			buffer[used++] = (char)((value & 0x7F) | (value >= 0x80 ? 0x80 : 0));
+			value >>= 7;
+		} while (value > 0);
+	}
+
+	void patchWriter::token(char op, uint64_t length)
+	{
+		if (format == patchFormat::binary)
+		{
+			if (checkpoints.empty() || opsSinceCheckpoint >= PATCHINDEXOPS || newOffset - checkpoints.back().newOffset >= PATCHINDEXBYTES)
+			{
+				checkpoints.push_back({ written + used, newOffset, oldOffset });
+				opsSinceCheckpoint = 0;
+			}
+			opsSinceCheckpoint++;
+			newOffset += op != '-' ? length : 0;
+			oldOffset += op != '+' ? length : 0;
+
+			append(&op, 1);
+			varint(length);
+			return;
+		}
+
+		// Longest token is the op, the brackets and 20 digits.
+		if (buffer.size() - used < 24)
+			flush();
+
+		char* out = &buffer[used];
+
+		*out++ = op;
+		*out++ = '[';
+		out = std::to_chars(out, &buffer[0] + buffer.size(), length).ptr;
+		*out++ = ']';
+		used = out - &buffer[0];
+	}
+
+	void patchWriter::append(const char* data, size_t length)
+	{
+		if (length > buffer.size() - used)
+		{
+			flush();
+
+			// Too big to be worth staging, write it from where it already is.
+			if (length >= buffer.size())
+			{
+				stream->write(data, length);
+				written += length;
+				return;
+			}
+		}
+
+		memcpy(&buffer[used], data, length);
+		used += length;
+	}
+
+	void patchWriter::fixedHeader(const patchHeader& header, char* out)
+	{
+		memcpy(out, binaryMagic, 4);
+		out[4] = PATCHVERSION;
+		out[5] = out[6] = out[7] = 0;
+		putLittleEndian(out + 8, header.oldSize);
+		putLittleEndian(out + 16, header.newSize);
+		putLittleEndian(out + 24, header.oldChecksum);
+		putLittleEndian(out + 32, header.newChecksum);
+	}
+
+	void patchWriter::writeHeader(const patchHeader& header)
+	{
+		if (format == patchFormat::text)
+		{
+			append(header.oldName.data(), header.oldName.size());
+			append("\n", 1);
+			append(header.newName.data(), header.newName.size());
+			append("\n", 1);
+			return;
+		}
+
+		char fixed[fixedHeaderSize];
+
+		fixedHeader(header, fixed);
+		append(fixed, fixedHeaderSize);
+
+		varint(header.oldName.size());
+		append(header.oldName.data(), header.oldName.size());
+		varint(header.newName.size());
+		append(header.newName.data(), header.newName.size());
+	}
+
+	void patchWriter::rewriteHeader(const patchHeader& header)
+	{
+		if (format == patchFormat::text)
+			return;
+
+		char fixed[fixedHeaderSize];
+
+		flush();
+		fixedHeader(header, fixed);
+
+		std::streampos end = stream->tellp();
+		stream->seekp(0);
+		stream->write(fixed, fixedHeaderSize);
+		stream->seekp(end);
+	}
+
+	void patchWriter::deleteBytes(uint64_t length)
+	{
+		token('-', length);
+	}
+
+	void patchWriter::insertBytes(const char* data, size_t length)
+	{
+		token('+', length);
+		append(data, length);
+	}
+
+	void patchWriter::copyBytes(uint64_t length)
+	{
+		token('S', length);
+	}
+
+	void patchWriter::finish(void)
+	{
+		if (format == patchFormat::binary)
+		{
+			char entry[checkpointSize];
+
+			append("E", 1);
+			for (const patchCheckpoint& checkpoint : checkpoints)
+			{
+				putLittleEndian(entry, checkpoint.patchOffset);
+				putLittleEndian(entry + 8, checkpoint.newOffset);
+				putLittleEndian(entry + 16, checkpoint.oldOffset);
+				append(entry, checkpointSize);
+			}
+			putLittleEndian(entry, checkpoints.size());
+			memcpy(entry + 8, indexMagic, 4);
+			append(entry, indexTrailerSize);
+		}
+		flush();
+	}
+
+	void patchWriter::flush(void)
+	{
+		if (used > 0)
+			stream->write(buffer.data(), used);
+		written += used;
+		used = 0;
+	}
+
+	patchWriter::patchWriter(std::fstream* aStream, patchFormat aFormat)
+	{
+		stream = aStream;
+		format = aFormat;
+		buffer.resize(PATCHBUFFERSIZE);
+		used = 0;
+		written = newOffset = oldOffset = 0;
+		opsSinceCheckpoint = 0;
+	}
+
+	patchWriter::~patchWriter()
+	{
+		flush();
+	}
+
+	bool patchReader::readVarint(uint64_t& value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (position >= size)
+				return false;
+
+			unsigned char byte = (unsigned char)data[position++];
+
+			value |= (uint64_t)(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	bool patchReader::readLine(std::string& line)
+	{
+		const char* end = (const char*)memchr(data + position, '\n', size - position);
+
+		if (end == nullptr)
+			return false;
+
+		line.assign(data + position, end);
+		position = end - data + 1;
+		return true;
+	}
+
+	bool patchReader::open(const char* aData, size_t aSize, patchHeader& header)
+	{
+		data = aData;
+		size = aSize;
+		position = 0;
+		ended = broken = false;
+		index = nullptr;
+		checkpointCount = 0;
+		header = { "", "", 0, 0, 0, 0, false };
+
+		if (size >= fixedHeaderSize && memcmp(data, binaryMagic, 4) == 0)
+		{
+			uint64_t nameLength;
+
+			format = patchFormat::binary;
+			if (data[4] != 1 && data[4] != PATCHVERSION)
+				return false;
+
+			// The index sits behind the ops, take it off the end so the ops stop where it starts.
+			if (data[4] >= 2)
+			{
+				if (size < fixedHeaderSize + indexTrailerSize || memcmp(data + size - 4, indexMagic, 4) != 0)
+					return false;
+
+				checkpointCount = (size_t)getLittleEndian(data + size - indexTrailerSize);
+				if (checkpointCount > (size - fixedHeaderSize - indexTrailerSize) / checkpointSize)
+					return false;
+
+				size -= indexTrailerSize + checkpointCount * checkpointSize;
+				index = data + size;
+			}
+
+			header.oldSize = getLittleEndian(data + 8);
+			header.newSize = getLittleEndian(data + 16);
+			header.oldChecksum = getLittleEndian(data + 24);
+			header.newChecksum = getLittleEndian(data + 32);
+			header.hasChecksums = true;
+			position = fixedHeaderSize;
+
+			if (!readVarint(nameLength) || nameLength > size - position)
+				return false;
+			header.oldName.assign(data + position, nameLength);
+			position += nameLength;
+
+			if (!readVarint(nameLength) || nameLength > size - position)
+				return false;
+			header.newName.assign(data + position, nameLength);
+			position += nameLength;
+			return true;
+		}
+
+		format = patchFormat::text;
+		return readLine(header.oldName) && readLine(header.newName);
+	}
+
+	bool patchReader::next(patchOp& op)
+	{
+		if (ended || broken)
+			return false;
+
+		if (position >= size)
+		{
+			// Text patches just stop, a binary one that stops without its end op has been cut short.
+			ended = true;
+			broken = format == patchFormat::binary;
+			return false;
+		}
+
+		op.type = data[position++];
+		op.payload = nullptr;
+
+		if (format == patchFormat::binary)
+		{
+			if (op.type == 'E')
+			{
+				ended = true;
+				return false;
+			}
+			if (!readVarint(op.length))
+				op.type = 0;
+		}
+		else
+		{
+			const char* close = position < size && data[position] == '[' ? (const char*)memchr(data + position, ']', size - position) : nullptr;
+
+			if (close == nullptr || std::from_chars(data + position + 1, close, op.length).ptr != close)
+				op.type = 0;
+			else
+				position = close - data + 1;
+		}
+
+		if (op.type == '+')
+		{
+			if (op.length > size - position)
+				op.type = 0;
+			else
+			{
+				op.payload = data + position;
+				position += op.length;
+			}
+		}
+
+		if (op.type != '-' && op.type != '+' && op.type != 'S')
+		{
+			broken = true;
+			return false;
+		}
+
+		return true;
+	}
+
+	bool patchReader::failed(void)
+	{
+		return broken;
+	}
+
+	patchFormat patchReader::getFormat(void)
+	{
+		return format;
+	}
+
+	void patchReader::readIndex(std::vector<patchCheckpoint>& checkpoints)
+	{
+		checkpoints.resize(checkpointCount);
+		for (size_t i = 0; i < checkpointCount; i++)
+		{
+			const char* entry = index + i * checkpointSize;
+
+			checkpoints[i] = { getLittleEndian(entry), getLittleEndian(entry + 8), getLittleEndian(entry + 16) };
+		}
+	}
+
+	uint64_t patchReader::tell(void)
+	{
+		return position;
+	}
+
+	uint64_t patchReader::end(void)
+	{
+		return size;
+	}
+
+	void patchReader::seek(uint64_t patchOffset)
+	{
+		// Past the end just reads as a patch that stops short.
+		position = (size_t)std::min<uint64_t>(patchOffset, size);
+		ended = broken = false;
+	}
+
+	patchReader::patchReader()
+	{
+		data = nullptr;
+		size = position = 0;
+		format = patchFormat::text;
+		ended = broken = false;
+		index = nullptr;
+		checkpointCount = 0;
+	}
+}
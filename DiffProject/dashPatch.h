@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#define PATCHBUFFERSIZE (1 << 20)	// Bytes of patch collected before they go to the stream in one write.
+#define CHECKSUMBLOCK (1 << 20)		// Checksums are taken per block of this many bytes, then folded together.
+#define PATCHVERSION 2				// Binary format version, bumped whenever the layout changes.
+#define PATCHINDEXOPS 4096			// Most ops between two checkpoints in a binary patch's index.
+#define PATCHINDEXBYTES (1 << 20)	// Most bytes of new file between two checkpoints.
+
+namespace dashDiff
+{
+	// The original text format: the two file names on a line each, then "-[n]", "+[n]" followed by n raw bytes, and
+	// "S[n]" tokens. The binary format is:
+	//
+	//   "DPHB", version byte, 3 reserved bytes
+	//   old size, new size, old checksum, new checksum		8 byte little endian each
+	//   old name, new name									varint length then the bytes
+	//   ops												'-', '+' or 'S', a varint length, and for '+' the bytes
+	//   'E'												end of ops
+	//   checkpoints										patch, new and old offset, 8 byte little endian each
+	//   checkpoint count									8 byte little endian
+	//   "DPHI"
+	//
+	// Varints are LEB128, 7 bits at a time, low bits first. Lengths under 128 take one byte, so most ops are 2 bytes.
+	// The checkpoints are where every so many ops start and how far into both files they start, so a patch can be
+	// applied in pieces without reading the ops before each one. Version 1 patches end at the 'E' and have none.
+	enum class patchFormat
+	{
+		text,
+		binary
+	};
+
+	struct patchHeader
+	{
+		std::string oldName;
+		std::string newName;
+		uint64_t oldSize;		// Sizes and checksums are only carried by the binary format.
+		uint64_t newSize;
+		uint64_t oldChecksum;
+		uint64_t newChecksum;
+		bool hasChecksums;
+	};
+
+	struct patchCheckpoint
+	{
+		uint64_t patchOffset;	// The op starting here.
+		uint64_t newOffset;		// Where its output goes.
+		uint64_t oldOffset;		// How far into the old file it starts.
+	};
+
+	struct patchOp
+	{
+		char type;				// '-', '+' or 'S'.
+		uint64_t length;
+		const char* payload;	// The inserted bytes for '+', nullptr otherwise.
+	};
+
+	// 64 bit checksum for the binary format. Data is cut into CHECKSUMBLOCK sized blocks that are each hashed on their
+	// own, four words at a time, and the block hashes are folded together in order. Blocks being independent means a
+	// big file can be hashed on every core and combined, or fed through update a piece at a time as it streams past.
+	class patchChecksum
+	{
+	private:
+		uint64_t state;
+		uint64_t totalLength;
+		std::vector<char> pending; // The unfinished block when update is handed pieces that don't line up with blocks.
+
+	public:
+		static uint64_t hashBlock(const char* data, size_t length);
+		static uint64_t ofBuffer(const char* data, size_t length);
+
+		void combine(uint64_t blockHash, size_t blockLength); // Blocks must come in order, and all but the last be full.
+		void update(const char* data, size_t length);
+		uint64_t value(void);
+
+		patchChecksum();
+	};
+
+	// Formats patch ops into one big reusable buffer and hands it to the stream a megabyte at a time. Insert payloads
+	// bigger than the buffer go straight from the caller's memory (usually the mapped new file) to the stream without
+	// being copied. Nothing reaches the stream until the buffer fills, flush is called, or the writer goes away.
+	class patchWriter
+	{
+	private:
+		std::fstream* stream;
+		patchFormat format;
+		std::vector<char> buffer;
+		size_t used;
+		uint64_t written;		// Bytes already handed to the stream, so written + used is where the next byte goes.
+		uint64_t newOffset;
+		uint64_t oldOffset;
+		size_t opsSinceCheckpoint;
+		std::vector<patchCheckpoint> checkpoints;
+
+		void varint(uint64_t value);
+		void token(char op, uint64_t length);
+		void append(const char* data, size_t length);
+		void fixedHeader(const patchHeader& header, char* out);
+
+	public:
+		void writeHeader(const patchHeader& header);
+		// Rewrites the sizes and checksums at the top of a binary patch, for when they weren't known up front.
+		void rewriteHeader(const patchHeader& header);
+		void deleteBytes(uint64_t length);					// -[n], skip n bytes of the old file.
+		void insertBytes(const char* data, size_t length);	// +[n] followed by the n bytes.
+		void copyBytes(uint64_t length);					// S[n], copy n bytes of the old file.
+		void finish(void);									// Ends the ops, adds the index and flushes.
+		void flush(void);
+
+		patchWriter(std::fstream* aStream, patchFormat aFormat);
+		~patchWriter();
+
+		patchWriter(const patchWriter&) = delete;
+		patchWriter& operator=(const patchWriter&) = delete;
+	};
+
+	// Walks a patch held in memory, in either format, one op at a time. Payloads point into the patch itself.
+	class patchReader
+	{
+	private:
+		const char* data;
+		size_t size;			// Where the ops end, the index isn't counted.
+		size_t position;
+		patchFormat format;
+		bool ended;
+		bool broken;
+		const char* index;
+		size_t checkpointCount;
+
+		bool readVarint(uint64_t& value);
+		bool readLine(std::string& line);
+
+	public:
+		bool open(const char* aData, size_t aSize, patchHeader& header);
+		bool next(patchOp& op); // False once the ops run out, check failed() to tell the end from a damaged patch.
+		bool failed(void);
+		patchFormat getFormat(void);
+		void readIndex(std::vector<patchCheckpoint>& checkpoints); // Empty for text and version 1 patches.
+		// Where the next op starts. A copy of an opened reader can seek to a checkpoint and carry on from there.
+		uint64_t tell(void);
+		void seek(uint64_t patchOffset);
+		uint64_t end(void); // Where the ops stop, the index isn't counted.
+
+		patchReader();
+	};
+}
@@ -0,0 +1,151 @@
+#include "dashPool.h"
+
+namespace dashDiff
+{
+	// Which pool and worker the current thread belongs to, if any.
+	static thread_local workPool* workerPool = nullptr;
+	static thread_local size_t workerIndex = 0;
+
+	workPool::workPool(size_t threadCount, task aIdleHook) : idleHook(std::move(aIdleHook))
+	{
+		queued = 0;
+		unfinished = 0;
+		nextQueue = 0;
+		stopping = false;
+
+		if (threadCount == 0)
+			threadCount = 1;
+
+		for (size_t i = 0; i < threadCount; i++)
+			queues.push_back(std::make_unique<workerQueue>());
+
+		for (size_t i = 0; i < threadCount; i++)
+			workers.emplace_back(&workPool::workerLoop, this, i);
+	}
+
+	workPool::~workPool()
+	{
+		wait();
+
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			stopping = true;
+		}
+		wakeWorkers.notify_all();
+
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	void workPool::submit(task aTask)
+	{
+		size_t index = workerPool == this ? workerIndex : nextQueue++ % queues.size();
+
+		unfinished++;
+
+		// Counted before it's published, a thief that takes it straight away mustn't take queued below zero. Taking the
+		// sleep lock means a worker can't be between checking for work and going to sleep, so it can't miss this.
+		{
+			std::lock_guard<std::mutex> lock(sleepMutex);
+			queued++;
+		}
+		{
+			std::lock_guard<std::mutex> lock(queues[index]->lock);
+			queues[index]->tasks.push_back(std::move(aTask));
+		}
+		wakeWorkers.notify_one();
+	}
+
+	void workPool::wait(void)
+	{
+		std::unique_lock<std::mutex> lock(sleepMutex);
+
+		allFinished.wait(lock, [this]() { return unfinished == 0; });
+	}
+
+	bool workPool::waitFor(std::chrono::milliseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(sleepMutex);
+
+		return allFinished.wait_for(lock, timeout, [this]() { return unfinished == 0; });
+	}
+
+	size_t workPool::size(void)
+	{
+		return workers.size();
+	}
+
+	int workPool::currentWorker(void)
+	{
+		return workerPool == this ? (int)workerIndex : -1;
+	}
+
+	bool workPool::takeTask(size_t index, task& aTask)
+	{
+		// Newest first from our own queue, it's the most likely to still be in cache.
+		{
+			std::lock_guard<std::mutex> lock(queues[index]->lock);
+
+			if (!queues[index]->tasks.empty())
+			{
+				aTask = std::move(queues[index]->tasks.back());
+				queues[index]->tasks.pop_back();
+				queued--;
+				return true;
+			}
+		}
+
+		// Oldest first from everyone else, the far end from where the owner is working so the two rarely meet. Which end
+		// holds the big pieces is up to whoever submits, the byte bucket tiles go in cheapest first so thieves get small ones.
+		for (size_t offset = 1; offset < queues.size(); offset++)
+		{
+			workerQueue& victim = *queues[(index + offset) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.lock);
+
+			if (!victim.tasks.empty())
+			{
+				aTask = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				queued--;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void workPool::workerLoop(size_t index)
+	{
+		workerPool = this;
+		workerIndex = index;
+
+		while (true)
+		{
+			task aTask;
+
+			if (takeTask(index, aTask))
+			{
+				aTask();
+
+				if (--unfinished == 0)
+				{
+					std::lock_guard<std::mutex> lock(sleepMutex);
+					allFinished.notify_all();
+				}
+				continue;
+			}
+
+			// Give whoever owns the pool a chance to break up a long running task before we sleep, whatever it
+			// hands back wakes us again.
+			if (idleHook)
+				idleHook();
+
+			std::unique_lock<std::mutex> lock(sleepMutex);
+
+			wakeWorkers.wait(lock, [this]() { return stopping || queued > 0; });
+
+			if (stopping && queued == 0)
+				return;
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <memory>
+#include <chrono>
+
+namespace dashDiff
+{
+	// A persistent pool of worker threads. Every worker owns a queue of tasks: it pushes and pops at the back of its own
+	// queue, and when that runs dry it steals from the front of everyone else's. Tasks are free to submit more tasks.
+	class workPool
+	{
+	public:
+		typedef std::function<void(void)> task;
+
+		// idleHook runs on a worker that has found nothing to do, just before it goes to sleep.
+		workPool(size_t threadCount, task aIdleHook = nullptr);
+		~workPool();
+
+		// From a worker the task goes on that worker's own queue, from anywhere else the queues take turns.
+		void submit(task aTask);
+		// Blocks until every task submitted so far, and everything they submitted in turn, has finished.
+		void wait(void);
+		// Same, but gives up after timeout. Returns true if everything finished, it wakes the moment the last task does.
+		bool waitFor(std::chrono::milliseconds timeout);
+
+		size_t size(void);
+		// Index of the worker calling this, or -1 when it isn't one of ours.
+		int currentWorker(void);
+
+	private:
+		struct workerQueue
+		{
+			std::mutex lock;
+			std::deque<task> tasks;
+		};
+
+		std::vector<std::unique_ptr<workerQueue>> queues;
+		std::vector<std::thread> workers;
+		task idleHook;
+
+		std::mutex sleepMutex;
+		std::condition_variable wakeWorkers;
+		std::condition_variable allFinished;
+
+		std::atomic<size_t> queued;		// Sitting in a queue, or about to be.
+		std::atomic<size_t> unfinished;	// Submitted and not yet finished, queued or running.
+		std::atomic<size_t> nextQueue;
+		bool stopping;
+
+		bool takeTask(size_t index, task& aTask);
+		void workerLoop(size_t index);
+	};
+}